@@ -0,0 +1,187 @@
+/*
+  jdep.h -- Java .class file dependency analyzer library interface
+
+  Copyright 2009 Chip Morningstar
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  Written by Chip Morningstar.
+*/
+
+/*
+  libjdep does everything the jdep command does, for programs that would
+  rather not fork a process per batch of class files.  All state lives in a
+  jdep_context, so a program can use as many of them as it likes, and nothing
+  in the library ever exits or prints anything: every operation returns a
+  jdep_status, and jdep_error_message() describes the most recent failure.
+
+  A typical use mirrors the command line:
+
+      jdep_context *ctx;
+      jdep_create(NULL, &ctx);
+      jdep_set_class_root(ctx, "classes");
+      jdep_set_java_root(ctx, "java");
+      jdep_set_dep_root(ctx, "depend");
+      jdep_analyze(ctx, files, fileCount);
+      jdep_finish(ctx);
+      jdep_destroy(ctx);
+*/
+
+#ifndef JDEP_H
+#define JDEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jdep_context jdep_context;
+
+typedef enum jdep_status {
+    JDEP_OK = 0,
+    JDEP_ERROR_MEMORY,          /* an allocation failed */
+    JDEP_ERROR_IO,              /* a file couldn't be read or written */
+    JDEP_ERROR_FORMAT,          /* a class, jar, graph or index file is bad */
+    JDEP_ERROR_ARGUMENT         /* e.g., a class file outside the class root */
+} jdep_status;
+
+/* Memory allocation functions.  They are called with the user pointer as
+   their first argument, and are expected to behave like malloc(), realloc()
+   and free(), respectively. */
+typedef struct jdep_allocator {
+    void *(*alloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t size);
+    void (*free)(void *user, void *ptr);
+    void *user;
+} jdep_allocator;
+
+/* Option flags for jdep_set_flags() */
+#define JDEP_ALL_PACKAGES   0x01    /* don't exclude java.*, javax.* or
+                                       com.sun.* (the -a option) */
+#define JDEP_NINJA          0x02    /* write Ninja depfiles (-n) */
+#define JDEP_ORDER_FILES    0x04    /* examine files in disk order (-o) */
+#define JDEP_MEMBERS        0x08    /* write .m member reference files (-M) */
+#define JDEP_GRAPH          0x10    /* collect the dependency graph (-g) */
+#define JDEP_REDUCE         0x20    /* share stamp files among the .d files
+                                       of each batch (-r) */
+#define JDEP_SMALL_CONSTANTS 0x40   /* match the constants -1 to 5 too (-z) */
+
+/* A dependency graph in compressed sparse row form.  Node IDs are assigned in
+   class name order; the dependencies of node n are edges[rowStart[n]] up to
+   (but not including) edges[rowStart[n + 1]], and its name is
+   &names[nameStart[n]]. */
+typedef struct jdep_graph {
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+    uint32_t nameBytes;
+    uint32_t *rowStart;
+    uint32_t *edges;
+    uint32_t *nameStart;
+    char *names;
+    void *mapping;              /* for a loaded graph, the mapped file */
+    size_t mappingSize;
+} jdep_graph;
+
+/* Called by jdep_class_prereqs() with each prerequisite path in turn */
+typedef void (*jdep_prereq_callback)(void *user, const char *prereq);
+
+/* Create a context.  If allocator is NULL, the standard C library allocator
+   is used. */
+jdep_status jdep_create(const jdep_allocator *allocator,
+                        jdep_context **result);
+void jdep_destroy(jdep_context *ctx);
+const char *jdep_error_message(const jdep_context *ctx);
+
+/* Configuration; these correspond to jdep's command line options */
+jdep_status jdep_set_flags(jdep_context *ctx, unsigned int flags);
+jdep_status jdep_set_class_root(jdep_context *ctx, const char *path);
+jdep_status jdep_set_dep_root(jdep_context *ctx, const char *path);
+jdep_status jdep_set_java_root(jdep_context *ctx, const char *path);
+jdep_status jdep_exclude_package(jdep_context *ctx, const char *package);
+jdep_status jdep_include_package(jdep_context *ctx, const char *package);
+jdep_status jdep_add_jars(jdep_context *ctx, const char *jars);
+jdep_status jdep_set_jar_index(jdep_context *ctx, const char *filename);
+jdep_status jdep_set_constant_index(jdep_context *ctx, const char *filename);
+jdep_status jdep_add_constant_uses(jdep_context *ctx, const char *filename);
+jdep_status jdep_set_dyndep_file(jdep_context *ctx, const char *filename);
+
+/* Examine class files with up to count threads (-p).  If makeflags, which
+   is normally the value of the MAKEFLAGS environment variable, advertises a
+   GNU make jobserver, each thread after the first has to get a token from it
+   first; otherwise all count threads are used.  The allocator must be
+   thread-safe if count is more than 1. */
+jdep_status jdep_set_workers(jdep_context *ctx, int count,
+                             const char *makeflags);
+
+/* Examine a batch of class files, writing their .d (and .m) files.  With
+   JDEP_REDUCE, prerequisites common to several classes of the batch are
+   gathered up into stamp files in the "_stamps" directory of the dep root,
+   so it pays to pass in as many class files at once as possible. */
+jdep_status jdep_analyze(jdep_context *ctx, const char *const files[],
+                         int count);
+
+/* Report the prerequisites of a single class file without writing anything.
+   If data is not NULL, it holds the contents of the class file (length bytes
+   of it); otherwise the file is read.  Inner classes are always read from
+   the class root. */
+jdep_status jdep_class_prereqs(jdep_context *ctx, const char *file,
+                               const void *data, size_t length,
+                               jdep_prereq_callback callback, void *user);
+
+/* Write the files that accumulate across batches: the dyndep file and the
+   jar and constant indexes */
+jdep_status jdep_finish(jdep_context *ctx);
+
+/* Update a file's timestamps, creating it and its directories if need be */
+jdep_status jdep_touch(jdep_context *ctx, const char *path);
+
+/* Dependency graphs.  jdep_graph_build() requires the JDEP_GRAPH flag to
+   have been set before the class files were analyzed.  jdep_graph_write()
+   picks the format from the file name: ".json", ".dot" or binary. */
+jdep_status jdep_graph_build(jdep_context *ctx, jdep_graph **result);
+jdep_status jdep_graph_load(jdep_context *ctx, const char *filename,
+                            jdep_graph **result);
+jdep_status jdep_graph_write(jdep_context *ctx, const jdep_graph *graph,
+                             const char *filename);
+void jdep_graph_free(jdep_context *ctx, jdep_graph *graph);
+
+/* Split the source files behind a graph into shardCount shards that can be
+   compiled separately (-P), setting shards[n] to the shard of node n.  The
+   shards are balanced by the total size of the sources' class files, the
+   sources of a dependency cycle always share a shard, and otherwise as few
+   dependencies as practical cross from one shard to another.
+   jdep_graph_write_shards() writes the list of the source files in shard k
+   to the file named prefix followed by "k.list". */
+jdep_status jdep_graph_partition(jdep_context *ctx, const jdep_graph *graph,
+                                 int shardCount, uint32_t shards[]);
+jdep_status jdep_graph_write_shards(jdep_context *ctx,
+                                    const jdep_graph *graph,
+                                    const uint32_t shards[], int shardCount,
+                                    const char *prefix);
+
+/* The node ID of the named class, or -1 if it isn't in the graph */
+long jdep_graph_find(const jdep_graph *graph, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JDEP_H */
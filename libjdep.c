@@ -0,0 +1,4654 @@
+/*
+  libjdep.c -- Java .class file dependency analyzer library
+
+  Copyright 2009 Chip Morningstar
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  Written by Chip Morningstar.
+*/
+
+#include <unistd.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jdep.h"
+
+typedef unsigned char   byte;           /*  8-bit number */
+typedef unsigned short  word;           /* 16-bit number */
+typedef uint32_t        longword;       /* 32-bit number */
+
+typedef int     bool;
+#define TRUE    1
+#define FALSE   0
+
+/* Everything is allocated with the context's allocator, by way of a Worker
+   so that running out of memory can be reported like any other error */
+#define FREE(w, p)          release(w, p)
+#define ALLOC(w, n)         allocate(w, n)
+#define REALLOC(w, p, n)    reallocate(w, p, n)
+
+#define TYPE_ALLOC(w, type)          ((type *) ALLOC(w, sizeof(type)))
+#define TYPE_ALLOC_MULTI(w, type, n) ((type *) ALLOC(w, sizeof(type) * (n)))
+#define TYPE_REALLOC_MULTI(w, type, p, n) \
+    ((type *) REALLOC(w, p, sizeof(type) * (n)))
+
+/* Scratch memory only lasts until the class file being examined is done
+   with, and is never freed piecemeal */
+#define SCRATCH_ALLOC(w, type)  ((type *) scratchAlloc(w, sizeof(type)))
+#define SCRATCH_ALLOC_MULTI(w, type, n) \
+    ((type *) scratchAlloc(w, sizeof(type) * (n)))
+
+typedef struct HashEntry {
+    char *key;
+    int value;
+    struct HashEntry *next;
+} HashEntry;
+
+typedef struct HashTable {
+    int size;
+    int count;
+    HashEntry **buckets;
+} HashTable;
+
+/* A growable list of strings */
+typedef struct List {
+    char **items;
+    int count;
+    int max;
+} List;
+
+/* A growable string, in scratch memory */
+typedef struct StringBuffer {
+    char *data;
+    size_t length;
+    size_t max;
+} StringBuffer;
+
+/* A block of scratch memory; the memory proper follows the header */
+typedef struct Chunk {
+    struct Chunk *next;
+    size_t size;
+    size_t used;
+} Chunk;
+
+#define CHUNK_SIZE      65536
+#define CHUNK_HEADER    ((sizeof(Chunk) + 15) & ~(size_t) 15)
+
+/* With JDEP_ORDER_FILES, class files are queued up and examined in on-disk
+   order */
+typedef struct QueuedFile {
+    const char *name;
+    char *path;
+    int dirLength;
+    dev_t dev;
+    ino_t ino;
+} QueuedFile;
+
+/* How many class files ahead of the current one to ask the kernel to read */
+#define READAHEAD_WINDOW 32
+
+/* How long to wait for a jobserver token before seeing whether there's still
+   any work left to use it on, in milliseconds */
+#define TOKEN_WAIT      50
+
+/* The state of one thread of analysis.  Errors longjmp back to onError,
+   which every API entry point sets up, so the code in between needn't check
+   for them. */
+typedef struct Worker {
+    jdep_context *ctx;
+    jmp_buf onError;
+    jdep_status status;
+    char message[1200];
+    Chunk *scratch;
+    void *pending;      /* freed if an error happens before it's stored */
+    FILE *input;        /* likewise closed; see readLine */
+    bool locked;        /* holds the context's lock; see lockShared */
+    int token;          /* the jobserver token it runs on, or -1 */
+    List deps;          /* classes the class being examined depends on */
+    List prereqs;       /* the files its .d file will list */
+    List sources;       /* the classes in deps behind those files */
+    List memberRefs;    /* with JDEP_MEMBERS, the members of other classes
+                           it refers to, as "owner.name:descriptor" for
+                           fields and as "owner.name(...)..." for methods */
+    QueuedFile *queue;
+    int queueLength;
+    int queueMax;
+} Worker;
+
+/* The whole-batch dependency graph as it is accumulated, one class file at a
+   time.  Class names are interned to node IDs; edges are (from, to) pairs. */
+typedef struct GraphBuilder {
+    HashTable *ids;
+    char **names;
+    int nodeCount;
+    int nodeMax;
+    uint32_t *edges;
+    int edgeCount;
+    int edgeMax;
+} GraphBuilder;
+
+/* A library jar and the classes it provides.  The size and modification time
+   are what the jar index file uses to decide if its entry is still good. */
+typedef struct JarInfo {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char **classes;
+    int classCount;
+    bool onClassPath;
+    struct JarInfo *next;
+} JarInfo;
+
+/* Prerequisites used by exactly the same classes of a batch, which with
+   JDEP_REDUCE are replaced in those classes' .d files by one stamp file
+   that depends on all of them */
+typedef struct PrereqUsers {
+    unsigned int signature;     /* hash of the users */
+    uint32_t count;
+    uint32_t *users;            /* indexes into batchClasses, ascending */
+    int prereq;
+} PrereqUsers;
+
+#define STAMP_DIR       "_stamps/"
+
+#define JAR_INDEX_HEADER "jdep jar index 1\n"
+
+/* A class (or rather, a source file) and the values of the compile-time
+   constants it defines, each as a key such as "I 70000" or "S some text" */
+typedef struct ConstantOwner {
+    char *name;
+    char **keys;
+    int keyCount;
+    int keyMax;
+    bool refreshed;     /* keys were re-read from class files in this batch */
+} ConstantOwner;
+
+/* One of the owners of a constant value; these are chained together */
+typedef struct ConstantDef {
+    int owner;
+    int next;
+    bool packageOnly;   /* only visible to classes in the owner's package */
+} ConstantDef;
+
+/* Keys of constants that can't be seen outside their package are recorded
+   with this in front of them */
+#define PACKAGE_KEY_PREFIX '~'
+
+#define CONSTANT_INDEX_PREFIX "jdep constant index "
+#define CONSTANT_INDEX_HEADER CONSTANT_INDEX_PREFIX "2\n"
+
+/* Ninja dyndep "build" statements, keyed by their (escaped) output path */
+typedef struct DyndepInfo {
+    HashTable *targets;
+    char **lines;
+    int count;
+    int max;
+} DyndepInfo;
+
+#define GRAPH_MAGIC             "JDEPGRPH"
+#define GRAPH_BYTE_ORDER        0x01020304
+#define GRAPH_VERSION           1
+
+/* Header of a binary graph file.  It is followed, in order, by the uint32_t
+   arrays rowStart[nodeCount + 1], edges[edgeCount] and nameStart[nodeCount],
+   and then by nameBytes bytes of NUL-terminated class names.  Everything is
+   in the byte order of the machine that wrote it, so the file can be mmap'ed
+   and used in place; byteOrder lets a reader detect a foreign file. */
+typedef struct GraphHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+    uint32_t nameBytes;
+    uint32_t reserved;
+} GraphHeader;
+
+typedef jdep_graph Graph;
+
+typedef struct PackageInfo {
+    char *name;
+    int   nameLength;
+    struct PackageInfo *next;
+} PackageInfo;
+
+struct jdep_context {
+    jdep_allocator allocator;
+    unsigned int flags;
+    char *classRoot;
+    char *depRoot;
+    char *javaRoot;
+    PackageInfo *excludedPackages;
+    PackageInfo *includedPackages;
+    bool libraryPackagesExcluded;
+
+    /* Directories known to exist, so mkdirPath needn't keep checking */
+    HashTable *knownDirectories;
+
+    GraphBuilder *graph;
+
+    /* With JDEP_REDUCE, the .d files aren't written until the whole batch
+       has been examined.  Meanwhile the prerequisites are interned in batch,
+       whose edges run from an index in batchClasses to a prerequisite. */
+    GraphBuilder *batch;
+    List batchClasses;
+
+    char *dyndepFile;
+    DyndepInfo *dyndeps;
+
+    JarInfo *jars;
+    JarInfo **classPath;
+    int classPathLength;
+    HashTable *jarClasses;      /* class name -> position in classPath */
+    char *jarIndexFile;
+    bool jarIndexChanged;
+
+    char *constantIndexFile;
+    ConstantOwner **constantOwners;
+    int constantOwnerCount;
+    int constantOwnerMax;
+    HashTable *constantOwnerIds;    /* class name -> constantOwners index */
+    HashTable *constantClassesSeen;
+    HashTable *constantValues;      /* key -> first constantDefs index */
+    ConstantDef *constantDefs;
+
+    /* Uses of constants recorded elsewhere (-K), for the ones javac leaves
+       no trace of: each user's outer class maps to the list of owners */
+    HashTable *constantUses;        /* class name -> constantUseLists index */
+    List *constantUseLists;
+    int constantUseCount;
+    int constantUseMax;
+
+    /* Parallel analysis.  While worker threads are running, the graph, the
+       batch, the dyndep statements and the known directories are only
+       touched with the lock held; everything else they share is read-only
+       until they are done. */
+    int workerMax;
+    int jobserverRead;          /* -1 if there's no (usable) jobserver */
+    int jobserverWrite;
+    bool threaded;
+    pthread_mutex_t lock;
+    int nextFile;               /* the next entry of main.queue to examine */
+    Worker *failure;            /* the first worker to fail */
+
+    Worker main;
+};
+
+#define CONSTANT_Class                   7
+#define CONSTANT_Double                  6
+#define CONSTANT_Fieldref                9
+#define CONSTANT_Float                   4
+#define CONSTANT_Integer                 3
+#define CONSTANT_InterfaceMethodref     11
+#define CONSTANT_InvokeDynamic          18
+#define CONSTANT_Long                    5
+#define CONSTANT_Methodref              10
+#define CONSTANT_MethodHandle           15
+#define CONSTANT_MethodType             16
+#define CONSTANT_NameAndType            12
+#define CONSTANT_String                  8
+#define CONSTANT_Utf8                    1
+
+#define CLASS_MAGIC             0xCAFEBABE
+
+#define ACC_PUBLIC              0x0001
+#define ACC_PRIVATE             0x0002
+#define ACC_PROTECTED           0x0004
+#define ACC_STATIC              0x0008
+#define ACC_FINAL               0x0010
+
+typedef struct attribute_info attribute_info;
+typedef struct classFile classFile;
+typedef struct cp_info cp_info;
+typedef struct constant_class_info constant_class_info;
+typedef struct constant_literal_info constant_literal_info;
+typedef struct constant_nameandtype_info constant_nameandtype_info;
+typedef struct constant_ref_info constant_ref_info;
+typedef struct constant_utf8_info constant_utf8_info;
+
+/* A bounded stretch of a class file (or of one of its attributes) being
+   decoded */
+typedef struct Input {
+    byte *pos;
+    byte *end;
+    char *filename;
+} Input;
+
+struct classFile {
+    char *filename;
+    word access_flags;
+    word constant_pool_count;
+    cp_info **constant_pool;
+    attribute_info *attributes;
+};
+
+struct attribute_info {
+    attribute_info *next;
+    word owner_flags;   /* access_flags of the field it came from, if any */
+    word attribute_name_index;
+    longword attribute_length;
+    byte *info;
+};
+
+struct cp_info {
+    int tag;            /* CONSTANT_xxxx */
+};
+
+struct constant_class_info {
+    int tag;            /* CONSTANT_Class */
+    word name_index;
+};
+
+struct constant_literal_info {
+    int tag;            /* CONSTANT_Integer, _Float, _Long, _Double, _String */
+    longword high;      /* high_bytes of a Long or Double */
+    longword low;       /* the bytes, low_bytes or string_index */
+};
+
+struct constant_nameandtype_info {
+    int tag;            /* CONSTANT_NameAndType */
+    word name_index;
+    word descriptor_index;
+};
+
+struct constant_ref_info {
+    int tag;            /* CONSTANT_Fieldref, _Methodref, _InterfaceMethodref */
+    word class_index;
+    word name_and_type_index;
+};
+
+struct constant_utf8_info {
+    int tag;            /* CONSTANT_Utf8 */
+    char *str;
+};
+
+/* Set up w to catch the errors raised while handling an API call, which
+   then returns the status the error was raised with */
+#define CATCH_ERRORS(w)                 \
+    (w)->status = JDEP_OK;              \
+    if (setjmp((w)->onError)) {         \
+        FREE(w, (w)->pending);          \
+        (w)->pending = NULL;            \
+        if ((w)->input) {               \
+            fclose((w)->input);         \
+            (w)->input = NULL;          \
+        }                               \
+        scratchReset(w);                \
+        return (w)->status;             \
+    }
+
+static void scanElementValue(Worker *w, Input *in, classFile *cf);
+
+
+static void addDyndep(Worker *w, DyndepInfo *dyndeps, char *target,
+    char *line);
+static void addGraphEdge(Worker *w, GraphBuilder *builder, char *from,
+    char *to);
+static void addBatchDeps(Worker *w, char *name);
+static void addConstantDeps(Worker *w, char *key, char *target);
+static void addConstantKey(Worker *w, ConstantOwner *owner, char *key);
+static void addConstantUse(Worker *w, char *user, char *owner);
+static void addMemberRef(Worker *w, classFile *cf, constant_ref_info *ref);
+static void *allocate(Worker *w, size_t size);
+static int compareNames(const void *a, const void *b);
+static int compareQueuedFiles(const void *a, const void *b);
+static Graph *buildGraph(Worker *w, GraphBuilder *builder);
+static GraphBuilder *buildGraphBuilder(Worker *w);
+static HashTable *buildHashTable(Worker *w, int size);
+static char *classNameOf(Worker *w, char *name);
+static void fail(Worker *w, jdep_status status, const char *format, ...);
+static ConstantOwner *findConstantOwner(Worker *w, char *name);
+static void findDeps(Worker *w, char *name);
+static void findDepsInFile(Worker *w, char *target, classFile *cf);
+static JarInfo *findJar(Worker *w, char *path);
+static int findComponents(Worker *w, int n, uint32_t *row, uint32_t *edges,
+    int *component);
+static void freeBatch(Worker *w);
+static void freeHashTable(Worker *w, HashTable *table);
+static FILE *fopenPath(Worker *w, char *path);
+static void formatPath(Worker *w, char *buf, size_t size,
+    const char *format, ...);
+static char *getClassName(Worker *w, classFile *cf, int index);
+static cp_info *getConstant(classFile *cf, int index);
+static char *getString(classFile *cf, int index);
+static bool graphIsConsistent(GraphHeader *header);
+static bool isIncludedClass(jdep_context *ctx, char *name);
+static bool isSmallConstant(char *key);
+static bool matchPackage(char *name, PackageInfo *packages);
+static HashEntry *hashInsert(Worker *w, HashTable *table, char *key,
+    int value);
+static HashEntry *hashLookup(HashTable *table, char *key);
+static int internNode(Worker *w, GraphBuilder *builder, char *name);
+static void listAdd(Worker *w, List *list, char *item);
+static void loadConstantUses(Worker *w, char *filename);
+static void lockShared(Worker *w);
+static void indexConstants(Worker *w);
+static char *literalKey(Worker *w, classFile *cf, int index);
+static classFile *loadClassFile(Worker *w, char *name, const void *data,
+    size_t length);
+static void prefetchFile(char *path);
+static bool makeDirectories(Worker *w, char *path);
+static bool mkdirPath(Worker *w, char *path);
+static int outerLength(const char *name);
+static void readJarClasses(Worker *w, JarInfo *jar);
+static char *readLine(Worker *w, StringBuffer *buf);
+static classFile *readClassFile(Worker *w, Input *in);
+static byte readByte(Worker *w, Input *in);
+static byte *readBytes(Worker *w, Input *in, size_t length);
+static cp_info **readConstantPool(Worker *w, Input *in, int count);
+static cp_info *readConstantPoolInfo(Worker *w, Input *in);
+static attribute_info *readFields(Worker *w, Input *in, int count,
+    attribute_info *atts);
+static longword readLong(Worker *w, Input *in);
+static attribute_info *readMethods(Worker *w, Input *in, int count,
+    attribute_info *atts);
+static word readWord(Worker *w, Input *in);
+static void recordConstants(Worker *w, char *name, ConstantOwner *owner);
+static void writeReducedDepFiles(Worker *w);
+static void writeStamp(Worker *w, char *path, char **prereqs, int count);
+static void *reallocate(Worker *w, void *ptr, size_t size);
+static void release(Worker *w, void *ptr);
+static void scanCode(Worker *w, classFile *cf, attribute_info *att,
+    char *target);
+static char *saveString(Worker *w, const char *str);
+static void *scratchAlloc(Worker *w, size_t size);
+static void scratchReset(Worker *w);
+static void unlockShared(Worker *w);
+static char *scratchString(Worker *w, const char *str, size_t length);
+
+
+  static bool
+addDep(Worker *w, char *name)
+{
+    int i;
+    for (i = 0; i < w->deps.count; ++i) {
+        if (strcmp(name, w->deps.items[i]) == 0) {
+            return FALSE;
+        }
+    }
+    if (w->deps.count == w->deps.max) {
+        w->deps.max = w->deps.max ? w->deps.max * 2 : 256;
+        w->deps.items = TYPE_REALLOC_MULTI(w, char *, w->deps.items,
+                                           w->deps.max);
+    }
+    w->deps.items[w->deps.count++] = scratchString(w, name, strlen(name));
+    return TRUE;
+}
+
+/* Hold on to the prerequisites of a class until the batch is done */
+  static void
+addBatchDeps(Worker *w, char *name)
+{
+    jdep_context *ctx = w->ctx;
+    GraphBuilder *batch = ctx->batch;
+    char *saved = saveString(w, name);
+    int i;
+
+    w->pending = saved;
+    listAdd(w, &ctx->batchClasses, saved);
+    w->pending = NULL;
+    for (i = 0; i < w->prereqs.count; ++i) {
+        if (batch->edgeCount == batch->edgeMax) {
+            batch->edgeMax = batch->edgeMax ? batch->edgeMax * 2 : 1024;
+            batch->edges = TYPE_REALLOC_MULTI(w, uint32_t, batch->edges,
+                                              batch->edgeMax * 2);
+        }
+        batch->edges[batch->edgeCount * 2] = ctx->batchClasses.count - 1;
+        batch->edges[batch->edgeCount * 2 + 1] =
+            internNode(w, batch, w->prereqs.items[i]);
+        ++batch->edgeCount;
+    }
+}
+
+/* Record the dyndep statement for target, replacing any earlier one */
+  static void
+addDyndep(Worker *w, DyndepInfo *dyndeps, char *target, char *line)
+{
+    HashEntry *entry = hashLookup(dyndeps->targets, target);
+    if (entry) {
+        FREE(w, dyndeps->lines[entry->value]);
+        dyndeps->lines[entry->value] = line;
+        return;
+    }
+    if (dyndeps->count == dyndeps->max) {
+        dyndeps->max = dyndeps->max ? dyndeps->max * 2 : 1024;
+        dyndeps->lines = TYPE_REALLOC_MULTI(w, char *, dyndeps->lines,
+                                            dyndeps->max);
+    }
+    hashInsert(w, dyndeps->targets, target, dyndeps->count);
+    dyndeps->lines[dyndeps->count++] = line;
+}
+
+  static void
+addConstantKey(Worker *w, ConstantOwner *owner, char *key)
+{
+    int i;
+    for (i = 0; i < owner->keyCount; ++i) {
+        if (strcmp(owner->keys[i], key) == 0) {
+            return;
+        }
+    }
+    if (owner->keyCount == owner->keyMax) {
+        owner->keyMax = owner->keyMax ? owner->keyMax * 2 : 16;
+        owner->keys = TYPE_REALLOC_MULTI(w, char *, owner->keys,
+                                         owner->keyMax);
+    }
+    owner->keys[owner->keyCount] = TYPE_ALLOC_MULTI(w, char, strlen(key) + 1);
+    strcpy(owner->keys[owner->keyCount++], key);
+}
+
+/* Is key one of the values javac has an instruction of its own to push
+   (the ints -1 to 5, the longs 0 and 1, the floats 0, 1 and 2 and the
+   doubles 0 and 1)?  Nearly every class pushes some of them, and one that
+   has them in its constant pool has them there for constants of its own. */
+  static bool
+isSmallConstant(char *key)
+{
+    static const char *others[] = {
+        "J 0", "J 1", "F 00000000", "F 3f800000", "F 40000000",
+        "D 0000000000000000", "D 3ff0000000000000"
+    };
+    int i;
+
+    if (key[0] == 'I') {
+        i = atoi(key + 2);
+        return i >= -1 && i <= 5;
+    }
+    for (i = 0; i < (int) (sizeof(others) / sizeof(others[0])); ++i) {
+        if (strcmp(key, others[i]) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Add dependencies on the classes that define a compile-time constant with
+   the value represented by key, which the target class might have inlined.
+   Small values only count with JDEP_SMALL_CONSTANTS. */
+  static void
+addConstantDeps(Worker *w, char *key, char *target)
+{
+    jdep_context *ctx = w->ctx;
+    HashEntry *entry;
+    int outerLength = strcspn(target, "$");
+    char *slash = rindex(target, '/');
+    int packageLength = slash ? slash - target + 1 : 0;
+    int def;
+
+    if (!(ctx->flags & JDEP_SMALL_CONSTANTS) && isSmallConstant(key)) {
+        return;
+    }
+    entry = hashLookup(ctx->constantValues, key);
+    for (def = entry ? entry->value : -1; def >= 0;
+             def = ctx->constantDefs[def].next) {
+        char *owner = ctx->constantOwners[ctx->constantDefs[def].owner]->name;
+        if (strncmp(owner, target, outerLength) == 0 &&
+                owner[outerLength] == '\0') {
+            /* Our own constant */
+            continue;
+        }
+        if (ctx->constantDefs[def].packageOnly &&
+                (strncmp(owner, target, packageLength) != 0 ||
+                 index(owner + packageLength, '/'))) {
+            /* Out of sight of the target */
+            continue;
+        }
+        if (isIncludedClass(ctx, owner)) {
+            addDep(w, owner);
+        }
+    }
+}
+
+/* Note that user uses (and may have inlined) a constant owner defines */
+  static void
+addConstantUse(Worker *w, char *user, char *owner)
+{
+    jdep_context *ctx = w->ctx;
+    HashEntry *entry;
+    List *owners;
+    char *saved;
+    int i;
+
+    if (!ctx->constantUses) {
+        ctx->constantUses = buildHashTable(w, 1024);
+    }
+    entry = hashLookup(ctx->constantUses, user);
+    if (!entry) {
+        if (ctx->constantUseCount == ctx->constantUseMax) {
+            ctx->constantUseMax =
+                ctx->constantUseMax ? ctx->constantUseMax * 2 : 256;
+            ctx->constantUseLists = TYPE_REALLOC_MULTI(w, List,
+                                                       ctx->constantUseLists,
+                                                       ctx->constantUseMax);
+        }
+        owners = &ctx->constantUseLists[ctx->constantUseCount];
+        owners->items = NULL;
+        owners->count = 0;
+        owners->max = 0;
+        entry = hashInsert(w, ctx->constantUses, user,
+                           ctx->constantUseCount);
+        ++ctx->constantUseCount;
+    }
+    owners = &ctx->constantUseLists[entry->value];
+    for (i = 0; i < owners->count; ++i) {
+        if (strcmp(owners->items[i], owner) == 0) {
+            return;
+        }
+    }
+    saved = saveString(w, owner);
+    w->pending = saved;
+    listAdd(w, owners, saved);
+    w->pending = NULL;
+}
+
+  static void
+addGraphEdge(Worker *w, GraphBuilder *builder, char *from, char *to)
+{
+    if (builder->edgeCount == builder->edgeMax) {
+        builder->edgeMax = builder->edgeMax ? builder->edgeMax * 2 : 1024;
+        builder->edges = TYPE_REALLOC_MULTI(w, uint32_t, builder->edges,
+                                            builder->edgeMax * 2);
+    }
+    builder->edges[builder->edgeCount * 2] = internNode(w, builder, from);
+    builder->edges[builder->edgeCount * 2 + 1] = internNode(w, builder, to);
+    ++builder->edgeCount;
+}
+
+/* Add the jars in a colon-separated list to the class path */
+  static void
+addJars(Worker *w, const char *jars)
+{
+    jdep_context *ctx = w->ctx;
+    char *path, *next;
+
+    for (path = scratchString(w, jars, strlen(jars)); path; path = next) {
+        next = strchr(path, ':');
+        if (next) {
+            *next++ = '\0';
+        }
+        if (*path) {
+            ctx->classPath = TYPE_REALLOC_MULTI(w, JarInfo *, ctx->classPath,
+                                                ctx->classPathLength + 1);
+            ctx->classPath[ctx->classPathLength++] = findJar(w, path);
+        }
+    }
+}
+
+  static void
+addMemberRef(Worker *w, classFile *cf, constant_ref_info *ref)
+{
+    char *owner = getClassName(w, cf, ref->class_index);
+    constant_nameandtype_info *nat = (constant_nameandtype_info *)
+        getConstant(cf, ref->name_and_type_index);
+    char *name;
+    char *descriptor;
+    int length;
+
+    if (!owner || owner[0] == '[' || !isIncludedClass(w->ctx, owner) ||
+            !nat || nat->tag != CONSTANT_NameAndType) {
+        return;
+    }
+    name = getString(cf, nat->name_index);
+    descriptor = getString(cf, nat->descriptor_index);
+    if (!name || !descriptor) {
+        return;
+    }
+    if (w->memberRefs.count == w->memberRefs.max) {
+        w->memberRefs.max = w->memberRefs.max ? w->memberRefs.max * 2 : 256;
+        w->memberRefs.items = TYPE_REALLOC_MULTI(w, char *, w->memberRefs.items,
+                                                 w->memberRefs.max);
+    }
+    length = strlen(owner) + strlen(name) + strlen(descriptor) + 3;
+    w->memberRefs.items[w->memberRefs.count] =
+        SCRATCH_ALLOC_MULTI(w, char, length);
+    snprintf(w->memberRefs.items[w->memberRefs.count++], length, "%s.%s%s%s",
+             owner, name, descriptor[0] == '(' ? "" : ":", descriptor);
+}
+
+  static void *
+allocate(Worker *w, size_t size)
+{
+    jdep_allocator *allocator = &w->ctx->allocator;
+    void *result = allocator->alloc(allocator->user, size ? size : 1);
+    if (!result) {
+        fail(w, JDEP_ERROR_MEMORY, "out of memory");
+    }
+    return result;
+}
+
+  static void
+appendString(Worker *w, StringBuffer *buf, char *str, size_t length)
+{
+    if (buf->length + length >= buf->max) {
+        size_t max = buf->max ? buf->max * 2 : 256;
+        char *data;
+        while (buf->length + length >= max) {
+            max *= 2;
+        }
+        data = SCRATCH_ALLOC_MULTI(w, char, max);
+        if (buf->length > 0) {
+            memcpy(data, buf->data, buf->length);
+        }
+        buf->data = data;
+        buf->max = max;
+    }
+    memcpy(buf->data + buf->length, str, length);
+    buf->length += length;
+    buf->data[buf->length] = '\0';
+}
+
+  static void
+appendChar(Worker *w, StringBuffer *buf, char c)
+{
+    appendString(w, buf, &c, 1);
+}
+
+/* Append a path escaped for Ninja, either for a depfile (which uses make's
+   backslash conventions) or for a manifest such as a dyndep file. */
+  static void
+appendEscapedPath(Worker *w, StringBuffer *buf, char *path, bool manifest)
+{
+    while (*path) {
+        char c = *path++;
+        if (c == '$') {
+            appendString(w, buf, "$$", 2);
+        } else if (manifest && (c == ' ' || c == ':')) {
+            appendChar(w, buf, '$');
+            appendChar(w, buf, c);
+        } else if (!manifest && (c == ' ' || c == '#')) {
+            appendChar(w, buf, '\\');
+            appendChar(w, buf, c);
+        } else {
+            appendChar(w, buf, c);
+        }
+    }
+}
+
+/* Find the dependencies of a class, and from them the source files and jars
+   it depends on, leaving them in w->deps, w->prereqs and w->sources.  The
+   class file is read unless its contents are supplied in data. */
+  static void
+collectPrereqs(Worker *w, char *name, const void *data, size_t length,
+               bool recordGraph)
+{
+    jdep_context *ctx = w->ctx;
+    GraphBuilder *graph = recordGraph ? ctx->graph : NULL;
+    char depfilename[1000];
+    int i, j;
+
+    w->deps.count = 0;
+    w->prereqs.count = 0;
+    w->sources.count = 0;
+    w->memberRefs.count = 0;
+    findDepsInFile(w, name, loadClassFile(w, name, data, length));
+    if (graph) {
+        lockShared(w);
+        internNode(w, graph, name);
+        unlockShared(w);
+    }
+
+    for (i = 0; i < w->deps.count; ++i) {
+        char *dep = w->deps.items[i];
+        if (index(dep, '$') == NULL) {
+            formatPath(w, depfilename, sizeof(depfilename), "%s%s.java",
+                       ctx->javaRoot, dep);
+            if (access(depfilename, F_OK) != -1) {
+                listAdd(w, &w->prereqs,
+                        scratchString(w, depfilename, strlen(depfilename)));
+                listAdd(w, &w->sources, dep);
+                if (graph && strcmp(dep, name) != 0) {
+                    lockShared(w);
+                    addGraphEdge(w, graph, name, dep);
+                    unlockShared(w);
+                }
+            } else if (ctx->jarClasses) {
+                /* Not one of ours; maybe it comes from a library jar */
+                HashEntry *entry = hashLookup(ctx->jarClasses, dep);
+                if (entry) {
+                    char *jar = ctx->classPath[entry->value]->path;
+                    listAdd(w, &w->sources, dep);
+                    for (j = 0; j < w->prereqs.count; ++j) {
+                        if (strcmp(w->prereqs.items[j], jar) == 0) {
+                            break;
+                        }
+                    }
+                    if (j == w->prereqs.count) {
+                        listAdd(w, &w->prereqs, jar);
+                    }
+                }
+            }
+        }
+    }
+}
+
+  static void
+writeDepFile(Worker *w, char *name, char *target)
+{
+    jdep_context *ctx = w->ctx;
+    char outfilename[1000];
+    StringBuffer ninja = { NULL, 0, 0 };
+    FILE *outfyle;
+    int i;
+
+    if (ctx->flags & JDEP_NINJA) {
+        appendEscapedPath(w, &ninja, target, FALSE);
+        appendChar(w, &ninja, ':');
+        for (i = 0; i < w->prereqs.count; ++i) {
+            appendString(w, &ninja, " \\\n  ", 5);
+            appendEscapedPath(w, &ninja, w->prereqs.items[i], FALSE);
+        }
+    }
+    formatPath(w, outfilename, sizeof(outfilename), "%s%s.d", ctx->depRoot,
+               name);
+    outfyle = fopenPath(w, outfilename);
+    if (!outfyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open output file %s", outfilename);
+    }
+    if (ctx->flags & JDEP_NINJA) {
+        fputs(ninja.data, outfyle);
+    } else {
+        fprintf(outfyle, "%s: \\\n", target);
+        for (i = 0; i < w->prereqs.count; ++i) {
+            fprintf(outfyle, "  %s\\\n", w->prereqs.items[i]);
+        }
+    }
+    fprintf(outfyle, "\n");
+    fclose(outfyle);
+}
+
+/* Write the .m file of member references for a class, leaving out members
+   of classes it doesn't depend on (i.e., itself and classes outside the
+   sources and jars it has dependencies on). */
+  static void
+writeMemberRefs(Worker *w, char *name)
+{
+    char outfilename[1000];
+    char **refs = w->memberRefs.items;
+    int refCount = w->memberRefs.count;
+    FILE *outfyle;
+    int nameLength = strcspn(name, "$");
+    int i, j;
+
+    formatPath(w, outfilename, sizeof(outfilename), "%s%s.m",
+               w->ctx->depRoot, name);
+    outfyle = fopenPath(w, outfilename);
+    if (!outfyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open output file %s", outfilename);
+    }
+    if (refCount > 0) {
+        qsort(refs, refCount, sizeof(char *), compareNames);
+    }
+    for (i = 0; i < refCount; ++i) {
+        char *ref = refs[i];
+        int ownerLength = strcspn(ref, "$.");
+        if (i > 0 && strcmp(ref, refs[i - 1]) == 0) {
+            continue;
+        }
+        if (ownerLength == nameLength && strncmp(ref, name, nameLength) == 0) {
+            continue;
+        }
+        for (j = 0; j < w->sources.count; ++j) {
+            char *source = w->sources.items[j];
+            if (strncmp(ref, source, ownerLength) == 0 &&
+                    source[ownerLength] == '\0') {
+                fprintf(outfyle, "%s\n", ref);
+                break;
+            }
+        }
+    }
+    fclose(outfyle);
+}
+
+  static void
+analyzeClassFile(Worker *w, const char *file)
+{
+    jdep_context *ctx = w->ctx;
+    char target[1000];
+    char *name = classNameOf(w, scratchString(w, file, strlen(file)));
+    int i;
+
+    collectPrereqs(w, name, NULL, 0, TRUE);
+    formatPath(w, target, sizeof(target), "%s%s.class", ctx->classRoot, name);
+    if (ctx->batch) {
+        lockShared(w);
+        addBatchDeps(w, name);
+        unlockShared(w);
+    } else {
+        writeDepFile(w, name, target);
+    }
+
+    if (ctx->dyndeps) {
+        StringBuffer key = { NULL, 0, 0 };
+        StringBuffer line = { NULL, 0, 0 };
+        char *saved;
+        appendEscapedPath(w, &key, target, TRUE);
+        appendString(w, &line, "build ", 6);
+        appendString(w, &line, key.data, key.length);
+        appendString(w, &line, ": dyndep", 8);
+        if (w->prereqs.count > 0) {
+            appendString(w, &line, " |", 2);
+            for (i = 0; i < w->prereqs.count; ++i) {
+                appendChar(w, &line, ' ');
+                appendEscapedPath(w, &line, w->prereqs.items[i], TRUE);
+            }
+        }
+        appendChar(w, &line, '\n');
+        saved = TYPE_ALLOC_MULTI(w, char, line.length + 1);
+        strcpy(saved, line.data);
+        w->pending = saved;
+        lockShared(w);
+        addDyndep(w, ctx->dyndeps, key.data, saved);
+        unlockShared(w);
+        w->pending = NULL;
+    }
+
+    if (ctx->flags & JDEP_MEMBERS) {
+        writeMemberRefs(w, name);
+    }
+}
+
+  static void
+queueClassFile(Worker *w, const char *name)
+{
+    QueuedFile *file;
+    struct stat st;
+    char *slash;
+    int length = strlen(name);
+
+    if (w->queueLength == w->queueMax) {
+        w->queueMax = w->queueMax ? w->queueMax * 2 : 1024;
+        w->queue = TYPE_REALLOC_MULTI(w, QueuedFile, w->queue, w->queueMax);
+    }
+    file = &w->queue[w->queueLength];
+    file->name = name;
+    file->path = TYPE_ALLOC_MULTI(w, char, length + 7);
+    ++w->queueLength;
+    if (length >= 6 && strcmp(name + length - 6, ".class") == 0) {
+        strcpy(file->path, name);
+    } else {
+        snprintf(file->path, length + 7, "%s.class", name);
+    }
+    slash = rindex(file->path, '/');
+    file->dirLength = slash ? slash - file->path : 0;
+    if (stat(file->path, &st) == 0) {
+        file->dev = st.st_dev;
+        file->ino = st.st_ino;
+    } else {
+        /* analyzeClassFile will complain about it soon enough */
+        file->dev = 0;
+        file->ino = 0;
+    }
+}
+
+  static void
+clearQueue(Worker *w)
+{
+    int i;
+    for (i = 0; i < w->queueLength; ++i) {
+        FREE(w, w->queue[i].path);
+    }
+    w->queueLength = 0;
+}
+
+/* The index in the queue of the next class file for a worker thread to
+   examine, or -1 if there are none left (or there's no point going on) */
+  static int
+takeFile(jdep_context *ctx)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (!ctx->failure && ctx->nextFile < ctx->main.queueLength) {
+        result = ctx->nextFile++;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return result;
+}
+
+  static bool
+workLeft(jdep_context *ctx)
+{
+    bool result;
+
+    pthread_mutex_lock(&ctx->lock);
+    result = !ctx->failure && ctx->nextFile < ctx->main.queueLength;
+    pthread_mutex_unlock(&ctx->lock);
+    return result;
+}
+
+/* Wait a little while for a jobserver token.  Returns the token, -1 if none
+   came along, or -2 if none ever will. */
+  static int
+acquireToken(jdep_context *ctx)
+{
+    struct pollfd pfd;
+    unsigned char token;
+
+    pfd.fd = ctx->jobserverRead;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, TOKEN_WAIT) < 0) {
+        return errno == EINTR ? -1 : -2;
+    } else if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return -2;
+    } else if (pfd.revents & POLLIN) {
+        /* Another of make's jobs may have beaten us to it, in which case
+           the read fails or, without /proc, waits for the next token */
+        if (read(ctx->jobserverRead, &token, 1) == 1) {
+            return token;
+        }
+    }
+    return -1;
+}
+
+  static void
+releaseToken(jdep_context *ctx, int token)
+{
+    unsigned char c = token;
+
+    if (token >= 0) {
+        while (write(ctx->jobserverWrite, &c, 1) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+/* The body of a worker thread: examine class files from the queue until
+   they run out or some worker fails, then give back its token */
+  static void *
+runWorker(void *arg)
+{
+    Worker *w = (Worker *) arg;
+    jdep_context *ctx = w->ctx;
+    QueuedFile *queue = ctx->main.queue;
+    int queueLength = ctx->main.queueLength;
+    bool ordered = (ctx->flags & JDEP_ORDER_FILES) != 0;
+    int i;
+
+    if (setjmp(w->onError)) {
+        unlockShared(w);
+        FREE(w, w->pending);
+        w->pending = NULL;
+        if (w->input) {
+            fclose(w->input);
+            w->input = NULL;
+        }
+        pthread_mutex_lock(&ctx->lock);
+        if (!ctx->failure) {
+            ctx->failure = w;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    } else {
+        while ((i = takeFile(ctx)) >= 0) {
+            if (ordered && i + READAHEAD_WINDOW < queueLength) {
+                prefetchFile(queue[i + READAHEAD_WINDOW].path);
+            }
+            analyzeClassFile(w, queue[i].name);
+            scratchReset(w);
+        }
+    }
+    scratchReset(w);
+    releaseToken(ctx, w->token);
+    return NULL;
+}
+
+  static void
+freeWorker(Worker *w)
+{
+    FREE(w, w->deps.items);
+    FREE(w, w->prereqs.items);
+    FREE(w, w->sources.items);
+    FREE(w, w->memberRefs.items);
+    scratchReset(w);
+    FREE(w, w->scratch);
+}
+
+/* Examine the queued class files with worker threads.  The first worker
+   runs on the job slot that jdep itself was started in; if make's jobserver
+   is available each of the others must first get a token from it, which it
+   gives back when there's no more work for it.  Returns FALSE if no thread
+   could be started at all. */
+  static bool
+analyzeInParallel(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+    pthread_t *threads = SCRATCH_ALLOC_MULTI(w, pthread_t, ctx->workerMax);
+    Worker *workers = TYPE_ALLOC_MULTI(w, Worker, ctx->workerMax);
+    char message[sizeof(w->message)];
+    jdep_status status = JDEP_OK;
+    int started = 0;
+    int i;
+
+    memset(workers, 0, sizeof(Worker) * ctx->workerMax);
+    for (i = 0; i < ctx->workerMax; ++i) {
+        workers[i].ctx = ctx;
+    }
+    ctx->nextFile = 0;
+    ctx->failure = NULL;
+    ctx->threaded = TRUE;
+    while (started < ctx->workerMax && workLeft(ctx)) {
+        int token = -1;
+        if (started > 0 && ctx->jobserverRead >= 0) {
+            token = acquireToken(ctx);
+            if (token == -2) {
+                break;
+            } else if (token < 0) {
+                continue;
+            }
+        }
+        workers[started].token = token;
+        if (pthread_create(&threads[started], NULL, runWorker,
+                           &workers[started]) != 0) {
+            releaseToken(ctx, token);
+            break;
+        }
+        ++started;
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ctx->threaded = FALSE;
+
+    if (ctx->failure) {
+        status = ctx->failure->status;
+        strcpy(message, ctx->failure->message);
+    }
+    for (i = 0; i < ctx->workerMax; ++i) {
+        freeWorker(&workers[i]);
+    }
+    FREE(w, workers);
+    if (status != JDEP_OK) {
+        fail(w, status, "%s", message);
+    }
+    return started > 0;
+}
+
+/* Examine a batch of class files.  With JDEP_ORDER_FILES, they are sorted by
+   directory and then by inode number, which approximates their order on
+   disk, and the kernel is kept a few files ahead of us.  When constants are
+   being tracked, all the constants defined in the batch have to be known
+   before we can tell which classes might have inlined them, so that takes a
+   pass of its own.  With JDEP_REDUCE, the .d files are written at the end,
+   once the prerequisites of every class in the batch are known.  If more
+   than one worker is allowed, the class files (though not the constants)
+   are examined in parallel. */
+  static void
+analyzeFiles(Worker *w, const char *const files[], int count)
+{
+    jdep_context *ctx = w->ctx;
+    bool ordered = (ctx->flags & JDEP_ORDER_FILES) != 0;
+    int i;
+
+    clearQueue(w);
+    freeBatch(w);
+    if (ctx->flags & JDEP_REDUCE) {
+        if (ctx->flags & JDEP_NINJA) {
+            fail(w, JDEP_ERROR_ARGUMENT,
+                 "reduced dependencies can't be written as Ninja depfiles");
+        }
+        ctx->batch = buildGraphBuilder(w);
+    }
+    for (i = 0; i < count; ++i) {
+        queueClassFile(w, files[i]);
+    }
+    if (ordered) {
+        qsort(w->queue, w->queueLength, sizeof(QueuedFile),
+              compareQueuedFiles);
+    }
+    if (ctx->constantIndexFile) {
+        if (ctx->constantClassesSeen) {
+            freeHashTable(w, ctx->constantClassesSeen);
+        }
+        ctx->constantClassesSeen = buildHashTable(w, 1024);
+        for (i = 0; i < ctx->constantOwnerCount; ++i) {
+            ctx->constantOwners[i]->refreshed = FALSE;
+        }
+        for (i = 0; i < w->queueLength; ++i) {
+            char *name = classNameOf(w, scratchString(w, w->queue[i].name,
+                                                      strlen(w->queue[i].name)));
+            recordConstants(w, name, findConstantOwner(w, name));
+            scratchReset(w);
+        }
+        indexConstants(w);
+    }
+    if (ordered) {
+        for (i = 0; i < READAHEAD_WINDOW && i < w->queueLength; ++i) {
+            prefetchFile(w->queue[i].path);
+        }
+    }
+    if (ctx->workerMax < 2 || w->queueLength < 2 || !analyzeInParallel(w)) {
+        for (i = 0; i < w->queueLength; ++i) {
+            if (ordered && i + READAHEAD_WINDOW < w->queueLength) {
+                prefetchFile(w->queue[i + READAHEAD_WINDOW].path);
+            }
+            analyzeClassFile(w, w->queue[i].name);
+            scratchReset(w);
+        }
+    }
+    clearQueue(w);
+    if (ctx->batch) {
+        writeReducedDepFiles(w);
+        scratchReset(w);
+        freeBatch(w);
+    }
+}
+
+  static attribute_info *
+build_attribute_info(Worker *w, word attribute_name_index,
+                     longword attribute_length, byte *info,
+                     attribute_info *next)
+{
+    attribute_info *result = SCRATCH_ALLOC(w, attribute_info);
+    result->next = next;
+    result->owner_flags = 0;
+    result->attribute_name_index = attribute_name_index;
+    result->attribute_length = attribute_length;
+    result->info = info;
+    return result;
+}
+
+  static classFile *
+build_classFile(Worker *w, char *filename, word access_flags,
+                word constant_pool_count, cp_info **constant_pool,
+                attribute_info *attributes)
+{
+    classFile *result = SCRATCH_ALLOC(w, classFile);
+    result->filename = filename;
+    result->access_flags = access_flags;
+    result->constant_pool_count = constant_pool_count;
+    result->constant_pool = constant_pool;
+    result->attributes = attributes;
+    return result;
+}
+
+  static constant_class_info *
+build_constant_class_info(Worker *w, word name_index)
+{
+    constant_class_info *result = SCRATCH_ALLOC(w, constant_class_info);
+    result->tag = CONSTANT_Class;
+    result->name_index = name_index;
+    return result;
+}
+
+  static constant_nameandtype_info *
+build_constant_nameandtype_info(Worker *w, word name_index,
+                                word descriptor_index)
+{
+    constant_nameandtype_info *result =
+        SCRATCH_ALLOC(w, constant_nameandtype_info);
+    result->tag = CONSTANT_NameAndType;
+    result->name_index = name_index;
+    result->descriptor_index = descriptor_index;
+    return result;
+}
+
+  static constant_ref_info *
+build_constant_ref_info(Worker *w, int tag, word class_index,
+                        word name_and_type_index)
+{
+    constant_ref_info *result = SCRATCH_ALLOC(w, constant_ref_info);
+    result->tag = tag;
+    result->class_index = class_index;
+    result->name_and_type_index = name_and_type_index;
+    return result;
+}
+
+  static constant_utf8_info *
+build_constant_utf8_info(Worker *w, char *str)
+{
+    constant_utf8_info *result = SCRATCH_ALLOC(w, constant_utf8_info);
+    result->tag = CONSTANT_Utf8;
+    result->str = str;
+    return result;
+}
+
+/* Turn a class file path into a class name, by chopping off any trailing
+   ".class" and the leading class root path.  Note that this modifies the
+   path in place. */
+  static char *
+classNameOf(Worker *w, char *name)
+{
+    char *classRoot = w->ctx->classRoot;
+    char *match = strstr(name, ".class");
+    if (match && strlen(match) == 6 /* strlen(".class") */) {
+        /* Chop off the trailing ".class" if it's there */
+        *match = '\0';
+    }
+
+    if (classRoot[0]) {
+        /* Strip leading class root path */
+        if (strncmp(name, classRoot, strlen(classRoot))) {
+            fail(w, JDEP_ERROR_ARGUMENT,
+                 "%s.class does not match class root path %s", name,
+                 classRoot);
+        }
+        name += strlen(classRoot);
+    }
+    return name;
+}
+
+  static int
+compareConstantOwners(const void *a, const void *b)
+{
+    return strcmp((*(ConstantOwner **) a)->name,
+                  (*(ConstantOwner **) b)->name);
+}
+
+  static int
+compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+  static int
+compareQueuedFiles(const void *a, const void *b)
+{
+    QueuedFile *x = (QueuedFile *) a;
+    QueuedFile *y = (QueuedFile *) b;
+    int result;
+
+    if (x->dirLength != y->dirLength) {
+        result = x->dirLength < y->dirLength ? x->dirLength : y->dirLength;
+        result = strncmp(x->path, y->path, result);
+        if (result == 0) {
+            result = x->dirLength < y->dirLength ? -1 : 1;
+        }
+    } else {
+        result = strncmp(x->path, y->path, x->dirLength);
+    }
+    if (result != 0) {
+        return result;
+    } else if (x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    } else if (x->ino != y->ino) {
+        return x->ino < y->ino ? -1 : 1;
+    } else {
+        return strcmp(x->path, y->path);
+    }
+}
+
+/* Order prerequisites so that the ones with the same users are adjacent */
+  static int
+comparePrereqUsers(const void *a, const void *b)
+{
+    const PrereqUsers *x = (const PrereqUsers *) a;
+    const PrereqUsers *y = (const PrereqUsers *) b;
+    int result;
+
+    if (x->signature != y->signature) {
+        return x->signature < y->signature ? -1 : 1;
+    } else if (x->count != y->count) {
+        return x->count < y->count ? -1 : 1;
+    }
+    result = memcmp(x->users, y->users, sizeof(uint32_t) * x->count);
+    return result ? result : x->prereq - y->prereq;
+}
+
+  static int
+compareNodeIds(const void *a, const void *b)
+{
+    uint32_t x = *(uint32_t *) a;
+    uint32_t y = *(uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Convert the accumulated edge list into compressed sparse row form, with the
+   nodes renumbered in name order and duplicate edges dropped. */
+  static Graph *
+buildGraph(Worker *w, GraphBuilder *builder)
+{
+    int nodeCount = builder->nodeCount;
+    char **sorted = SCRATCH_ALLOC_MULTI(w, char *, nodeCount + 1);
+    uint32_t *renumber = SCRATCH_ALLOC_MULTI(w, uint32_t, nodeCount + 1);
+    uint32_t *fill = SCRATCH_ALLOC_MULTI(w, uint32_t, nodeCount + 1);
+    Graph *graph;
+    uint32_t edgeCount = 0;
+    uint32_t nameBytes = 0;
+    int i;
+
+    if (nodeCount > 0) {
+        memcpy(sorted, builder->names, sizeof(char *) * nodeCount);
+    }
+    qsort(sorted, nodeCount, sizeof(char *), compareNames);
+    for (i = 0; i < nodeCount; ++i) {
+        renumber[hashLookup(builder->ids, sorted[i])->value] = i;
+        nameBytes += strlen(sorted[i]) + 1;
+    }
+
+    /* The graph and all its arrays are allocated in one piece */
+    graph = (Graph *) ALLOC(w, sizeof(Graph) + nameBytes + 1 +
+        sizeof(uint32_t) * ((size_t) nodeCount * 2 + builder->edgeCount + 3));
+    memset(graph, 0, sizeof(Graph));
+    graph->rowStart = (uint32_t *) (graph + 1);
+    graph->edges = graph->rowStart + nodeCount + 1;
+    graph->nameStart = graph->edges + builder->edgeCount + 1;
+    graph->names = (char *) (graph->nameStart + nodeCount + 1);
+
+    /* Bucket the edges by their (renumbered) source node */
+    memset(fill, 0, sizeof(uint32_t) * (nodeCount + 1));
+    for (i = 0; i < builder->edgeCount; ++i) {
+        ++fill[renumber[builder->edges[i * 2]] + 1];
+    }
+    for (i = 0; i < nodeCount; ++i) {
+        fill[i + 1] += fill[i];
+    }
+    for (i = 0; i < builder->edgeCount; ++i) {
+        uint32_t from = renumber[builder->edges[i * 2]];
+        graph->edges[fill[from]++] = renumber[builder->edges[i * 2 + 1]];
+    }
+
+    /* fill[n] is now the end of row n; sort and de-duplicate each row,
+       compacting the edge array in place as we go */
+    graph->rowStart[0] = 0;
+    for (i = 0; i < nodeCount; ++i) {
+        uint32_t start = i ? fill[i - 1] : 0;
+        uint32_t j;
+        qsort(&graph->edges[start], fill[i] - start, sizeof(uint32_t),
+              compareNodeIds);
+        for (j = start; j < fill[i]; ++j) {
+            if (j == start || graph->edges[j] != graph->edges[j - 1]) {
+                graph->edges[edgeCount++] = graph->edges[j];
+            }
+        }
+        graph->rowStart[i + 1] = edgeCount;
+    }
+
+    graph->nodeCount = nodeCount;
+    graph->edgeCount = edgeCount;
+    graph->nameBytes = nameBytes;
+    nameBytes = 0;
+    for (i = 0; i < nodeCount; ++i) {
+        graph->nameStart[i] = nameBytes;
+        strcpy(&graph->names[nameBytes], sorted[i]);
+        nameBytes += strlen(sorted[i]) + 1;
+    }
+    return graph;
+}
+
+  static DyndepInfo *
+buildDyndepInfo(Worker *w)
+{
+    DyndepInfo *result = TYPE_ALLOC(w, DyndepInfo);
+    result->lines = NULL;
+    result->count = 0;
+    result->max = 0;
+    w->pending = result;
+    result->targets = buildHashTable(w, 1024);
+    w->pending = NULL;
+    return result;
+}
+
+  static GraphBuilder *
+buildGraphBuilder(Worker *w)
+{
+    GraphBuilder *result = TYPE_ALLOC(w, GraphBuilder);
+    result->names = NULL;
+    result->nodeCount = 0;
+    result->nodeMax = 0;
+    result->edges = NULL;
+    result->edgeCount = 0;
+    result->edgeMax = 0;
+    w->pending = result;
+    result->ids = buildHashTable(w, 4096);
+    w->pending = NULL;
+    return result;
+}
+
+/* The buckets aren't allocated until something is inserted */
+  static HashTable *
+buildHashTable(Worker *w, int size)
+{
+    HashTable *result = TYPE_ALLOC(w, HashTable);
+    result->size = size;
+    result->count = 0;
+    result->buckets = NULL;
+    return result;
+}
+
+  static constant_literal_info *
+build_constant_literal_info(Worker *w, int tag, longword high, longword low)
+{
+    constant_literal_info *result = SCRATCH_ALLOC(w, constant_literal_info);
+    result->tag = tag;
+    result->high = high;
+    result->low = low;
+    return result;
+}
+
+  static PackageInfo *
+buildPackageInfo(Worker *w, const char *name, PackageInfo *next)
+{
+    PackageInfo *package = (PackageInfo *)
+        ALLOC(w, sizeof(PackageInfo) + strlen(name) + 2);
+    char *pathName;
+    bool slashFlag = FALSE;
+
+    package->next = next;
+    package->name = pathName = (char *) (package + 1);
+    while (*name) {
+        if (*name == '.') {
+            *pathName++ = '/';
+            slashFlag = TRUE;
+        } else {
+            *pathName++ = *name;
+            slashFlag = FALSE;
+        }
+        ++name;
+    }
+    if (!slashFlag) {
+        *pathName++ = '/';
+    }
+    *pathName = '\0';
+    package->nameLength = strlen(package->name);
+    return package;
+}
+
+  static void
+excludePackage(Worker *w, const char *name)
+{
+    w->ctx->excludedPackages =
+        buildPackageInfo(w, name, w->ctx->excludedPackages);
+}
+
+  static void
+fail(Worker *w, jdep_status status, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(w->message, sizeof(w->message), format, args);
+    va_end(args);
+    w->status = status;
+    longjmp(w->onError, 1);
+}
+
+  static void
+findDeps(Worker *w, char *name)
+{
+    findDepsInFile(w, name, loadClassFile(w, name, NULL, 0));
+}
+
+  static char *
+getString(classFile *cf, int index)
+{
+    cp_info *cp = getConstant(cf, index);
+    if (cp && cp->tag == CONSTANT_Utf8) {
+        char *name = ((constant_utf8_info *) cp)->str;
+        return name;
+    }
+    return NULL;
+}
+
+  static cp_info *
+getConstant(classFile *cf, int index)
+{
+    if (index <= 0 || index >= cf->constant_pool_count) {
+        return NULL;
+    }
+    return cf->constant_pool[index];
+}
+
+  static char *
+getClassName(Worker *w, classFile *cf, int index)
+{
+    cp_info *cp = getConstant(cf, index);
+    if (cp == NULL) {
+        return NULL;
+    } else if (cp->tag == CONSTANT_Class) {
+        constant_class_info *classInfo = (constant_class_info *) cp;
+        return getString(cf, classInfo->name_index);
+    } else if (cp->tag == CONSTANT_Utf8) {
+        char *name = ((constant_utf8_info *) cp)->str;
+        if (name[0] == 'L') {
+            return scratchString(w, name + 1, strcspn(name + 1, ";"));
+        }
+    }
+    return NULL;
+}
+
+  static void
+scanAnnotation(Worker *w, Input *in, classFile *cf)
+{
+    int i;
+
+    int type_index = readWord(w, in);
+
+    char *name = getClassName(w, cf, type_index);
+    if (isIncludedClass(w->ctx, name)) {
+        addDep(w, name);
+    }
+    int num_element_value_pairs = readWord(w, in);
+    for (i = 0; i < num_element_value_pairs; ++i) {
+        readWord(w, in); /* element_name_index */
+        scanElementValue(w, in, cf);
+    }
+}
+
+/* Sizes of the JVM instructions, indexed by opcode; 0 marks the ones whose
+   size varies (tableswitch, lookupswitch and wide) or that don't exist */
+static const byte InstructionSizes[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /*   0 */
+    2, 3, 2, 3, 3, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1,     /*  16 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /*  32 */
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1,     /*  48 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /*  64 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /*  80 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /*  96 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 112 */
+    1, 1, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 128 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3, 3,     /* 144 */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 0, 0, 1, 1, 1, 1,     /* 160 */
+    1, 1, 3, 3, 3, 3, 3, 3, 3, 5, 5, 3, 2, 3, 1, 1,     /* 176 */
+    3, 3, 1, 1, 0, 4, 3, 3, 5, 5,                       /* 192 */
+};
+
+#define OP_iconst_m1             2
+#define OP_iconst_5              8
+#define OP_lconst_0              9
+#define OP_lconst_1             10
+#define OP_fconst_0             11
+#define OP_fconst_2             13
+#define OP_dconst_0             14
+#define OP_dconst_1             15
+#define OP_bipush               16
+#define OP_sipush               17
+#define OP_tableswitch         170
+#define OP_lookupswitch        171
+#define OP_wide                196
+#define OP_iinc                132
+
+/* Scan a method's bytecode for values pushed by the instructions that take
+   no constant pool entry, which is how javac inlines int constants that fit
+   in 16 bits (booleans included) and the longs 0 and 1, the floats 0, 1 and
+   2 and the doubles 0 and 1.  Those last, and the ints from -1 to 5, are
+   only matched with JDEP_SMALL_CONSTANTS (see isSmallConstant()). */
+  static void
+scanCode(Worker *w, classFile *cf, attribute_info *att, char *target)
+{
+    Input in;
+    byte *code;
+    longword codeLength;
+    longword pc = 0;
+    char key[20];
+
+    in.pos = att->info;
+    in.end = att->info + att->attribute_length;
+    in.filename = cf->filename;
+    readWord(w, &in); /* max_stack */
+    readWord(w, &in); /* max_locals */
+    codeLength = readLong(w, &in);
+    code = readBytes(w, &in, codeLength);
+    while (pc < codeLength) {
+        byte opcode = code[pc];
+        longword size = InstructionSizes[opcode];
+        int value;
+
+        if (opcode == OP_tableswitch || opcode == OP_lookupswitch) {
+            Input operands;
+            longword start = (pc + 4) & ~3; /* 4-byte aligned */
+            longword count;
+            if (start > codeLength) {
+                break;
+            }
+            operands.pos = code + start;
+            operands.end = code + codeLength;
+            operands.filename = cf->filename;
+            readLong(w, &operands); /* default */
+            if (opcode == OP_tableswitch) {
+                longword low = readLong(w, &operands);
+                longword high = readLong(w, &operands);
+                count = high - low + 1;
+            } else {
+                count = readLong(w, &operands) * 2;
+            }
+            readBytes(w, &operands, (size_t) count * 4);
+            size = operands.pos - (code + pc);
+        } else if (opcode == OP_wide) {
+            size = pc + 1 < codeLength && code[pc + 1] == OP_iinc ? 6 : 4;
+        } else if (size == 0) {
+            /* Not a real instruction; give up on this method */
+            break;
+        }
+        if (size > codeLength - pc) {
+            /* Nor is a truncated one */
+            break;
+        }
+        key[0] = '\0';
+        if (opcode >= OP_iconst_m1 && opcode <= OP_iconst_5) {
+            snprintf(key, sizeof(key), "I %d", opcode - OP_iconst_m1 - 1);
+        } else if (opcode == OP_lconst_0 || opcode == OP_lconst_1) {
+            snprintf(key, sizeof(key), "J %d", opcode - OP_lconst_0);
+        } else if (opcode >= OP_fconst_0 && opcode <= OP_fconst_2) {
+            /* The bits of 0.0f, 1.0f and 2.0f, as literalKey has them */
+            static const char *floats[] = { "00000000", "3f800000",
+                                            "40000000" };
+            snprintf(key, sizeof(key), "F %s", floats[opcode - OP_fconst_0]);
+        } else if (opcode == OP_dconst_0 || opcode == OP_dconst_1) {
+            snprintf(key, sizeof(key), "D %s", opcode == OP_dconst_0 ?
+                     "0000000000000000" : "3ff0000000000000");
+        } else if (opcode == OP_bipush || opcode == OP_sipush) {
+            if (opcode == OP_bipush) {
+                value = (signed char) code[pc + 1];
+            } else {
+                value = (short) ((code[pc + 1] << 8) | code[pc + 2]);
+            }
+            snprintf(key, sizeof(key), "I %d", value);
+        }
+        if (key[0]) {
+            addConstantDeps(w, key, target);
+        }
+        pc += size;
+    }
+}
+
+  static void
+scanElementValue(Worker *w, Input *in, classFile *cf)
+{
+    byte tag = readByte(w, in);
+    switch (tag) {
+        case 'B':
+        case 'C':
+        case 'D':
+        case 'F':
+        case 'I':
+        case 'J':
+        case 'S':
+        case 'Z':
+        case 's':
+            readWord(w, in); /* const_value_index */
+            break;
+        case 'c':
+            readWord(w, in); /* class_info_index */
+            break;
+        case 'e': {
+            int type_name_index = readWord(w, in);
+            char *name = getClassName(w, cf, type_name_index);
+            readWord(w, in); /* const_name_index */
+            if (isIncludedClass(w->ctx, name)) {
+                addDep(w, name);
+            }
+            break;
+        }
+        case '@':
+            scanAnnotation(w, in, cf);
+            break;
+        case '[': {
+            int num_values = readWord(w, in);
+            int i;
+            for (i = 0; i < num_values; ++i) {
+                scanElementValue(w, in, cf);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+  static void
+findDepsInFile(Worker *w, char *target, classFile *cf)
+{
+    jdep_context *ctx = w->ctx;
+    attribute_info *att;
+    int i;
+
+    if (ctx->flags & JDEP_ORDER_FILES) {
+        /* We're about to recurse into our inner classes; get the reads of
+           all of them started now, rather than one at a time */
+        for (i = 0 ; i < cf->constant_pool_count; ++i) {
+            cp_info *cp = cf->constant_pool[i];
+            if (cp && cp->tag == CONSTANT_Class) {
+                char *name = getClassName(w, cf, i);
+                char *dollar = name ? index(name, '$') : NULL;
+                if (dollar && name[0] != '[' &&
+                        (int) strcspn(target, "$") == dollar - name &&
+                        strncmp(name, target, dollar-name) == 0 &&
+                        strcmp(name, target) != 0) {
+                    char infilename[1000];
+                    formatPath(w, infilename, sizeof(infilename),
+                               "%s%s.class", ctx->classRoot, name);
+                    prefetchFile(infilename);
+                }
+            }
+        }
+    }
+
+    for (i = 0 ; i < cf->constant_pool_count; ++i) {
+        cp_info *cp = cf->constant_pool[i];
+        if (cp && ctx->constantValues && (cp->tag == CONSTANT_Integer ||
+                                          cp->tag == CONSTANT_Float ||
+                                          cp->tag == CONSTANT_Long ||
+                                          cp->tag == CONSTANT_Double ||
+                                          cp->tag == CONSTANT_String)) {
+            char *key = literalKey(w, cf, i);
+            if (key) {
+                addConstantDeps(w, key, target);
+            }
+        } else if (cp && (ctx->flags & JDEP_MEMBERS) &&
+                       (cp->tag == CONSTANT_Fieldref ||
+                        cp->tag == CONSTANT_Methodref ||
+                        cp->tag == CONSTANT_InterfaceMethodref)) {
+            addMemberRef(w, cf, (constant_ref_info *) cp);
+        } else if (cp && cp->tag == CONSTANT_Class) {
+            char *name = getClassName(w, cf, i);
+            if (isIncludedClass(ctx, name)) {
+                if (name[0] != '[') { /* Skip array classes */
+                    char *dollar = index(name, '$');
+                    if (dollar) {
+                        /* It's an inner class */
+                        if (strncmp(name, target, dollar-name) == 0) {
+                                /* It's one of target's inner classes, so we
+                                   depend on whatever *it* depends on and thus
+                                   we need to recurse. */
+                            if (addDep(w, name)) {
+                                findDeps(w, name);
+                            }
+                        } else {
+                                /* It's somebody else's inner class, so we
+                                   depend on its outer class source file */
+                            *dollar = '\0';
+                            addDep(w, name);
+                            *dollar = '$';
+                        }
+                    } else {
+                        /* It's a regular class */
+                        addDep(w, name);
+                    }
+                }
+            }
+        }
+    }
+
+    if (ctx->constantUses && !index(target, '$')) {
+        HashEntry *entry = hashLookup(ctx->constantUses, target);
+        if (entry) {
+            List *owners = &ctx->constantUseLists[entry->value];
+            for (i = 0; i < owners->count; ++i) {
+                char *owner = owners->items[i];
+                if (strcmp(owner, target) != 0 &&
+                        isIncludedClass(ctx, owner)) {
+                    addDep(w, owner);
+                }
+            }
+        }
+    }
+
+    for (att = cf->attributes; att != NULL; att = att->next) {
+        char *name = getString(cf, att->attribute_name_index);
+        if (!name) {
+            continue;
+        } else if (strcmp(name, "RuntimeVisibleAnnotations") == 0) {
+            Input in;
+            int num_annotations;
+            in.pos = att->info;
+            in.end = att->info + att->attribute_length;
+            in.filename = cf->filename;
+            num_annotations = readWord(w, &in);
+            for (i = 0; i < num_annotations; ++i) {
+                scanAnnotation(w, &in, cf);
+            }
+        } else if (ctx->constantValues && strcmp(name, "Code") == 0) {
+            scanCode(w, cf, att, target);
+        }
+    }
+}
+
+  static ConstantOwner *
+findConstantOwner(Worker *w, char *name)
+{
+    jdep_context *ctx = w->ctx;
+    HashEntry *entry;
+    ConstantOwner *owner;
+    int outerLength = strcspn(name, "$");
+    char *outer = scratchString(w, name, outerLength);
+
+    if (!ctx->constantOwnerIds) {
+        ctx->constantOwnerIds = buildHashTable(w, 1024);
+    }
+    entry = hashLookup(ctx->constantOwnerIds, outer);
+    if (entry) {
+        return ctx->constantOwners[entry->value];
+    }
+    if (ctx->constantOwnerCount == ctx->constantOwnerMax) {
+        ctx->constantOwnerMax =
+            ctx->constantOwnerMax ? ctx->constantOwnerMax * 2 : 1024;
+        ctx->constantOwners = TYPE_REALLOC_MULTI(w, ConstantOwner *,
+                                                 ctx->constantOwners,
+                                                 ctx->constantOwnerMax);
+    }
+    owner = TYPE_ALLOC(w, ConstantOwner);
+    owner->keys = NULL;
+    owner->keyCount = 0;
+    owner->keyMax = 0;
+    owner->refreshed = FALSE;
+    w->pending = owner;
+    entry = hashInsert(w, ctx->constantOwnerIds, outer,
+                       ctx->constantOwnerCount);
+    w->pending = NULL;
+    owner->name = entry->key;
+    ctx->constantOwners[ctx->constantOwnerCount++] = owner;
+    return owner;
+}
+
+/* Find the JarInfo for a jar, creating one if this is a new jar */
+  static JarInfo *
+findJar(Worker *w, char *path)
+{
+    jdep_context *ctx = w->ctx;
+    JarInfo *jar;
+
+    for (jar = ctx->jars; jar; jar = jar->next) {
+        if (strcmp(jar->path, path) == 0) {
+            return jar;
+        }
+    }
+    jar = (JarInfo *) ALLOC(w, sizeof(JarInfo) + strlen(path) + 1);
+    jar->path = strcpy((char *) (jar + 1), path);
+    jar->mtime = 0;
+    jar->size = -1;
+    jar->classes = NULL;
+    jar->classCount = 0;
+    jar->onClassPath = FALSE;
+    jar->next = ctx->jars;
+    ctx->jars = jar;
+    return jar;
+}
+
+  static FILE *
+fopenPath(Worker *w, char *path)
+{
+    char *end = rindex(path, '/');
+    if (end) {
+        *end = '\0';
+        mkdirPath(w, path);
+        *end = '/';
+    }
+    return fopen(path, "w");
+}
+
+/* Format a path into a buffer of the given size, failing rather than going
+   on with a truncated one */
+  static void
+formatPath(Worker *w, char *buf, size_t size, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buf, size, format, args);
+    va_end(args);
+    if (length < 0 || (size_t) length >= size) {
+        fail(w, JDEP_ERROR_ARGUMENT, "path too long: %.200s...", buf);
+    }
+}
+
+  static void
+freeBatch(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+    int i;
+
+    if (ctx->batch) {
+        freeHashTable(w, ctx->batch->ids);
+        FREE(w, ctx->batch->names);
+        FREE(w, ctx->batch->edges);
+        FREE(w, ctx->batch);
+        ctx->batch = NULL;
+    }
+    for (i = 0; i < ctx->batchClasses.count; ++i) {
+        FREE(w, ctx->batchClasses.items[i]);
+    }
+    ctx->batchClasses.count = 0;
+}
+
+  static void
+freeHashTable(Worker *w, HashTable *table)
+{
+    HashEntry *entry;
+    int i;
+
+    for (i = 0; table->buckets && i < table->size; ++i) {
+        while ((entry = table->buckets[i])) {
+            table->buckets[i] = entry->next;
+            FREE(w, entry);
+        }
+    }
+    FREE(w, table->buckets);
+    FREE(w, table);
+}
+
+  static unsigned int
+hashString(char *str)
+{
+    /* FNV-1a */
+    unsigned int result = 2166136261u;
+    while (*str) {
+        result = (result ^ (byte) *str++) * 16777619u;
+    }
+    return result;
+}
+
+  static HashEntry *
+hashInsert(Worker *w, HashTable *table, char *key, int value)
+{
+    HashEntry *entry;
+    int i;
+
+    if (!table->buckets) {
+        table->buckets = TYPE_ALLOC_MULTI(w, HashEntry *, table->size);
+        memset(table->buckets, 0, sizeof(HashEntry *) * table->size);
+    } else if (table->count >= table->size) {
+        /* Keep the chains short by doubling the bucket array */
+        int newSize = table->size * 2;
+        HashEntry **newBuckets = TYPE_ALLOC_MULTI(w, HashEntry *, newSize);
+        memset(newBuckets, 0, sizeof(HashEntry *) * newSize);
+        for (i = 0; i < table->size; ++i) {
+            while ((entry = table->buckets[i])) {
+                int bucket = hashString(entry->key) % newSize;
+                table->buckets[i] = entry->next;
+                entry->next = newBuckets[bucket];
+                newBuckets[bucket] = entry;
+            }
+        }
+        FREE(w, table->buckets);
+        table->buckets = newBuckets;
+        table->size = newSize;
+    }
+
+    i = hashString(key) % table->size;
+    entry = (HashEntry *) ALLOC(w, sizeof(HashEntry) + strlen(key) + 1);
+    entry->key = (char *) (entry + 1);
+    strcpy(entry->key, key);
+    entry->value = value;
+    entry->next = table->buckets[i];
+    table->buckets[i] = entry;
+    ++table->count;
+    return entry;
+}
+
+  static HashEntry *
+hashLookup(HashTable *table, char *key)
+{
+    HashEntry *entry;
+
+    if (!table->buckets) {
+        return NULL;
+    }
+    entry = table->buckets[hashString(key) % table->size];
+    while (entry) {
+        if (strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+/* Build the map from class names to the jars that provide them, scanning the
+   jars that the jar index file (if any) didn't already know about. */
+  static void
+indexJars(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+    struct stat st;
+    int i, j;
+
+    ctx->jarClasses = buildHashTable(w, 16384);
+    for (i = 0; i < ctx->classPathLength; ++i) {
+        JarInfo *jar = ctx->classPath[i];
+        if (stat(jar->path, &st) < 0) {
+            fail(w, JDEP_ERROR_IO, "unable to open jar file %s", jar->path);
+        }
+        if (!jar->onClassPath &&
+                (st.st_mtime != jar->mtime || st.st_size != jar->size)) {
+            for (j = 0; j < jar->classCount; ++j) {
+                FREE(w, jar->classes[j]);
+            }
+            FREE(w, jar->classes);
+            jar->classes = NULL;
+            jar->classCount = 0;
+            jar->mtime = st.st_mtime;
+            jar->size = st.st_size;
+            readJarClasses(w, jar);
+            scratchReset(w);
+            ctx->jarIndexChanged = TRUE;
+        }
+        jar->onClassPath = TRUE;
+        /* As with the Java class path, the first jar to provide a class wins */
+        for (j = 0; j < jar->classCount; ++j) {
+            if (!hashLookup(ctx->jarClasses, jar->classes[j])) {
+                hashInsert(w, ctx->jarClasses, jar->classes[j], i);
+            }
+        }
+    }
+}
+
+/* Build the map from constant values to the classes that define them */
+  static void
+indexConstants(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+    int defCount = 0;
+    int i, j;
+
+    if (ctx->constantValues) {
+        freeHashTable(w, ctx->constantValues);
+        ctx->constantValues = NULL;
+    }
+    FREE(w, ctx->constantDefs);
+    ctx->constantDefs = NULL;
+    for (i = 0; i < ctx->constantOwnerCount; ++i) {
+        defCount += ctx->constantOwners[i]->keyCount;
+    }
+    ctx->constantDefs = TYPE_ALLOC_MULTI(w, ConstantDef, defCount + 1);
+    ctx->constantValues = buildHashTable(w, 4096);
+    defCount = 0;
+    for (i = 0; i < ctx->constantOwnerCount; ++i) {
+        for (j = 0; j < ctx->constantOwners[i]->keyCount; ++j) {
+            char *key = ctx->constantOwners[i]->keys[j];
+            bool packageOnly = key[0] == PACKAGE_KEY_PREFIX;
+            HashEntry *entry;
+            if (packageOnly) {
+                ++key;
+            }
+            entry = hashLookup(ctx->constantValues, key);
+            ctx->constantDefs[defCount].owner = i;
+            ctx->constantDefs[defCount].packageOnly = packageOnly;
+            if (entry) {
+                ctx->constantDefs[defCount].next = entry->value;
+                entry->value = defCount;
+            } else {
+                ctx->constantDefs[defCount].next = -1;
+                hashInsert(w, ctx->constantValues, key, defCount);
+            }
+            ++defCount;
+        }
+    }
+}
+
+  static void
+includePackage(Worker *w, const char *name)
+{
+    w->ctx->includedPackages =
+        buildPackageInfo(w, name, w->ctx->includedPackages);
+}
+
+  static int
+internNode(Worker *w, GraphBuilder *builder, char *name)
+{
+    HashEntry *entry = hashLookup(builder->ids, name);
+    if (entry) {
+        return entry->value;
+    }
+    if (builder->nodeCount == builder->nodeMax) {
+        builder->nodeMax = builder->nodeMax ? builder->nodeMax * 2 : 1024;
+        builder->names = TYPE_REALLOC_MULTI(w, char *, builder->names,
+                                            builder->nodeMax);
+    }
+    entry = hashInsert(w, builder->ids, name, builder->nodeCount);
+    builder->names[builder->nodeCount] = entry->key;
+    return builder->nodeCount++;
+}
+
+  static bool
+isIncludedClass(jdep_context *ctx, char *name)
+{
+    if (!name || matchPackage(name, ctx->excludedPackages)) {
+        return FALSE;
+    }
+    if (ctx->includedPackages) {
+        return matchPackage(name, ctx->includedPackages);
+    } else {
+        return TRUE;
+    }
+}
+
+  static void
+listAdd(Worker *w, List *list, char *item)
+{
+    if (list->count == list->max) {
+        list->max = list->max ? list->max * 2 : 256;
+        list->items = TYPE_REALLOC_MULTI(w, char *, list->items, list->max);
+    }
+    list->items[list->count++] = item;
+}
+
+/* Take the context's lock, if worker threads are running.  A worker that
+   fails while holding it lets it go on its way out (see runWorker). */
+  static void
+lockShared(Worker *w)
+{
+    if (w->ctx->threaded) {
+        pthread_mutex_lock(&w->ctx->lock);
+        w->locked = TRUE;
+    }
+}
+
+/* Represent the value of a constant pool literal as a string key, which is
+   also the form the values take in the constant index file.  Floating point
+   values are represented by their bits, so that NaN and -0.0 come out right,
+   and strings are escaped so that every key fits on one line. */
+  static char *
+literalKey(Worker *w, classFile *cf, int index)
+{
+    constant_literal_info *literal =
+        (constant_literal_info *) getConstant(cf, index);
+    StringBuffer key = { NULL, 0, 0 };
+    char number[40];
+
+    if (!literal) {
+        return NULL;
+    }
+    number[0] = '\0';
+    switch (literal->tag) {
+        case CONSTANT_Integer:
+            snprintf(number, sizeof(number), "I %d", (int32_t) literal->low);
+            break;
+        case CONSTANT_Float:
+            snprintf(number, sizeof(number), "F %08x", literal->low);
+            break;
+        case CONSTANT_Long:
+            snprintf(number, sizeof(number), "J %lld", (long long) (int64_t)
+                     (((uint64_t) literal->high << 32) | literal->low));
+            break;
+        case CONSTANT_Double:
+            snprintf(number, sizeof(number), "D %08x%08x", literal->high,
+                     literal->low);
+            break;
+        case CONSTANT_String: {
+            char *str = getString(cf, literal->low);
+            if (!str) {
+                break;
+            }
+            appendString(w, &key, "S ", 2);
+            for (; *str; ++str) {
+                if (*str == '\\') {
+                    appendString(w, &key, "\\\\", 2);
+                } else if (*str == '\n') {
+                    appendString(w, &key, "\\n", 2);
+                } else if (*str == '\r') {
+                    appendString(w, &key, "\\r", 2);
+                } else {
+                    appendChar(w, &key, *str);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (number[0]) {
+        appendString(w, &key, number, strlen(number));
+    }
+    return key.length > 0 ? key.data : NULL;
+}
+
+/* Read a class file, or take it from data if that's supplied.  Either way,
+   the class file lives in scratch memory. */
+  static classFile *
+loadClassFile(Worker *w, char *name, const void *data, size_t length)
+{
+    char infilename[1000];
+    struct stat st;
+    Input in;
+    byte *buf;
+    int fd;
+
+    formatPath(w, infilename, sizeof(infilename), "%s%s.class",
+               w->ctx->classRoot, name);
+    in.filename = scratchString(w, infilename, strlen(infilename));
+    if (data) {
+        buf = (byte *) data;
+    } else {
+        size_t done = 0;
+        fd = open(infilename, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fail(w, JDEP_ERROR_IO, "unable to open class file %s",
+                 infilename);
+        }
+        length = st.st_size;
+        buf = SCRATCH_ALLOC_MULTI(w, byte, length + 1);
+        while (done < length) {
+            ssize_t count = read(fd, buf + done, length - done);
+            if (count <= 0) {
+                close(fd);
+                fail(w, JDEP_ERROR_IO, "unable to read class file %s",
+                     infilename);
+            }
+            done += count;
+        }
+        close(fd);
+    }
+    in.pos = buf;
+    in.end = buf + length;
+    return readClassFile(w, &in);
+}
+
+/* Read a constant index file written by an earlier run */
+  static void
+loadConstantIndex(Worker *w, char *filename)
+{
+    ConstantOwner *owner = NULL;
+    StringBuffer buf = { NULL, 0, 0 };
+    char *line;
+
+    w->input = fopen(filename, "r");
+    if (!w->input) {
+        /* No index yet; it will be created */
+        return;
+    }
+    line = readLine(w, &buf);
+    if (line && strcmp(line, CONSTANT_INDEX_HEADER) != 0 &&
+            strncmp(line, CONSTANT_INDEX_PREFIX,
+                    strlen(CONSTANT_INDEX_PREFIX)) == 0) {
+        fail(w, JDEP_ERROR_FORMAT, "constant index file %s was written by "
+             "an older jdep; remove it and rerun over all the classes",
+             filename);
+    }
+    if (!line || strcmp(line, CONSTANT_INDEX_HEADER) != 0) {
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a jdep constant index file",
+             filename);
+    }
+    while ((line = readLine(w, &buf))) {
+        if (line[buf.length - 1] == '\n') {
+            line[buf.length - 1] = '\0';
+        }
+        if (line[0] == ' ') {
+            if (owner) {
+                addConstantKey(w, owner, line + 1);
+            }
+        } else if (line[0]) {
+            owner = findConstantOwner(w, line);
+        }
+    }
+    fclose(w->input);
+    w->input = NULL;
+}
+
+/* Read a file of constant uses, each line naming a class and then the class
+   whose constant it uses, in either internal ("a/b/C") or source ("a.b.C")
+   form.  Blank lines and lines starting with '#' are ignored. */
+  static void
+loadConstantUses(Worker *w, char *filename)
+{
+    StringBuffer buf = { NULL, 0, 0 };
+    char *line;
+    int lineNumber = 0;
+
+    w->input = fopen(filename, "r");
+    if (!w->input) {
+        fail(w, JDEP_ERROR_IO, "unable to open constant uses file %s",
+             filename);
+    }
+    while ((line = readLine(w, &buf))) {
+        char *user, *owner, *end, *p;
+        ++lineNumber;
+        for (p = line; *p; ++p) {
+            if (*p == '.') {
+                *p = '/';
+            } else if (*p == '\n' || *p == '\r') {
+                *p = '\0';
+                break;
+            }
+        }
+        user = line + strspn(line, " \t");
+        if (*user == '\0' || *user == '#') {
+            continue;
+        }
+        end = user + strcspn(user, " \t");
+        owner = end + strspn(end, " \t");
+        p = owner + strcspn(owner, " \t");
+        if (*owner == '\0' || p[strspn(p, " \t")] != '\0') {
+            fail(w, JDEP_ERROR_FORMAT,
+                 "%s:%d: expected a class and the class whose constant it "
+                 "uses", filename, lineNumber);
+        }
+        /* The source files are what depend on one another */
+        user[strcspn(user, "$ \t")] = '\0';
+        owner[strcspn(owner, "$ \t")] = '\0';
+        addConstantUse(w, user, owner);
+    }
+    fclose(w->input);
+    w->input = NULL;
+}
+
+/* Check that the arrays of a mapped graph file (already known to be long
+   enough) stay within one another, so nothing that walks the graph can be
+   led outside of it */
+  static bool
+graphIsConsistent(GraphHeader *header)
+{
+    uint32_t *rowStart = (uint32_t *) (header + 1);
+    uint32_t *edges = rowStart + header->nodeCount + 1;
+    uint32_t *nameStart = edges + header->edgeCount;
+    char *names = (char *) (nameStart + header->nodeCount);
+    uint32_t i;
+
+    if (rowStart[0] != 0 || rowStart[header->nodeCount] > header->edgeCount) {
+        return FALSE;
+    }
+    for (i = 0; i < header->nodeCount; ++i) {
+        if (rowStart[i] > rowStart[i + 1] ||
+                nameStart[i] >= header->nameBytes) {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < header->edgeCount; ++i) {
+        if (edges[i] >= header->nodeCount) {
+            return FALSE;
+        }
+    }
+    /* With a NUL at the very end, every name is terminated */
+    return header->nameBytes == 0 || names[header->nameBytes - 1] == '\0';
+}
+
+/* Map a binary graph file into memory.  No copying or parsing is done beyond
+   checking the header, so this is cheap even for very large graphs. */
+  static Graph *
+loadGraph(Worker *w, char *filename)
+{
+    struct stat st;
+    GraphHeader *header;
+    Graph *graph;
+    uint32_t *data;
+    size_t size;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fail(w, JDEP_ERROR_IO, "unable to open graph file %s", filename);
+    }
+    if ((size_t) st.st_size < sizeof(GraphHeader)) {
+        close(fd);
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a jdep graph file", filename);
+    }
+    header = (GraphHeader *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                  fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fail(w, JDEP_ERROR_IO, "unable to map graph file %s", filename);
+    }
+    if (memcmp(header->magic, GRAPH_MAGIC, sizeof(header->magic)) != 0) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a jdep graph file", filename);
+    }
+    if (header->byteOrder != GRAPH_BYTE_ORDER) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_FORMAT, "graph file %s has the wrong byte order",
+             filename);
+    }
+    if (header->version != GRAPH_VERSION) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_FORMAT, "graph file %s has unsupported version %u",
+             filename, header->version);
+    }
+    size = sizeof(GraphHeader) + header->nameBytes + sizeof(uint32_t) *
+        ((size_t) header->nodeCount * 2 + 1 + header->edgeCount);
+    if ((size_t) st.st_size < size) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_FORMAT, "graph file %s is truncated", filename);
+    }
+    if (!graphIsConsistent(header)) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_FORMAT, "graph file %s is corrupt", filename);
+    }
+
+    graph = (Graph *) w->ctx->allocator.alloc(w->ctx->allocator.user,
+                                              sizeof(Graph));
+    if (!graph) {
+        munmap(header, st.st_size);
+        fail(w, JDEP_ERROR_MEMORY, "out of memory");
+    }
+    graph->nodeCount = header->nodeCount;
+    graph->edgeCount = header->edgeCount;
+    graph->nameBytes = header->nameBytes;
+    data = (uint32_t *) (header + 1);
+    graph->rowStart = data;
+    data += graph->nodeCount + 1;
+    graph->edges = data;
+    data += graph->edgeCount;
+    graph->nameStart = data;
+    data += graph->nodeCount;
+    graph->names = (char *) data;
+    graph->mapping = header;
+    graph->mappingSize = st.st_size;
+    return graph;
+}
+
+/* Read a jar index file written by an earlier run.  Entries for jars that
+   have since changed are ignored when the jars are indexed. */
+  static void
+loadJarIndex(Worker *w, char *filename)
+{
+    JarInfo *jar = NULL;
+    StringBuffer buf = { NULL, 0, 0 };
+    char *line;
+    int count = 0;
+
+    w->input = fopen(filename, "r");
+    if (!w->input) {
+        /* No index yet; it will be created */
+        w->ctx->jarIndexChanged = TRUE;
+        return;
+    }
+    line = readLine(w, &buf);
+    if (!line || strcmp(line, JAR_INDEX_HEADER) != 0) {
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a jdep jar index file",
+             filename);
+    }
+    while ((line = readLine(w, &buf))) {
+        long long mtime, jarSize;
+        int offset;
+        if (line[buf.length - 1] == '\n') {
+            line[buf.length - 1] = '\0';
+        }
+        if (line[0] == ' ') {
+            if (jar && jar->classCount < count) {
+                char *className = saveString(w, line + 1);
+                jar->classes[jar->classCount++] = className;
+            }
+        } else if (sscanf(line, "jar %lld %lld %d %n", &mtime, &jarSize,
+                          &count, &offset) == 3 && count >= 0) {
+            int i;
+            jar = findJar(w, line + offset);
+            jar->mtime = mtime;
+            jar->size = jarSize;
+            for (i = 0; i < jar->classCount; ++i) {
+                FREE(w, jar->classes[i]);
+            }
+            FREE(w, jar->classes);
+            jar->classes = NULL;
+            jar->classCount = 0;
+            jar->classes = TYPE_ALLOC_MULTI(w, char *, count + 1);
+        }
+    }
+    fclose(w->input);
+    w->input = NULL;
+}
+
+  static bool
+matchPackage(char *name, PackageInfo *packages)
+{
+    while (packages) {
+        if (strncmp(name, packages->name, packages->nameLength) == 0) {
+            return TRUE;
+        }
+        packages = packages->next;
+    }
+    return FALSE;
+}
+
+/* Create the directories on a path, returning TRUE if that failed */
+  static bool
+mkdirPath(Worker *w, char *path)
+{
+    bool result;
+
+    lockShared(w);
+    result = makeDirectories(w, path);
+    unlockShared(w);
+    return result;
+}
+
+  static bool
+makeDirectories(Worker *w, char *path)
+{
+    jdep_context *ctx = w->ctx;
+    char *slashptr = path;
+    DIR *dyr;
+
+    if (!ctx->knownDirectories) {
+        ctx->knownDirectories = buildHashTable(w, 1024);
+    } else if (hashLookup(ctx->knownDirectories, path)) {
+        return FALSE;
+    }
+
+    while ((slashptr = strchr(slashptr + 1, '/'))) {
+        *slashptr = '\0';
+        if (!hashLookup(ctx->knownDirectories, path)) {
+            dyr = opendir(path);
+            if (dyr) {
+                closedir(dyr);
+            } else if (mkdir(path, 0777) < 0) {
+                *slashptr = '/';
+                return TRUE;
+            }
+            hashInsert(w, ctx->knownDirectories, path, 0);
+        }
+        *slashptr = '/';
+        if (slashptr[1] == '\0') {
+            /* Just ignore a trailing slash */
+            return FALSE;
+        }
+    }
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+        return TRUE;
+    } else {
+        hashInsert(w, ctx->knownDirectories, path, 0);
+        return FALSE;
+    }
+}
+
+  static word
+decodeLittleWord(byte *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+  static uint32_t
+decodeLittleLong(byte *buf)
+{
+    return decodeLittleWord(buf) | ((uint32_t) decodeLittleWord(buf + 2) << 16);
+}
+
+  static uint64_t
+decodeLittleQuad(byte *buf)
+{
+    return decodeLittleLong(buf) | ((uint64_t) decodeLittleLong(buf + 4) << 32);
+}
+
+  static byte *
+readJarBytes(Worker *w, int fd, JarInfo *jar, off_t offset, size_t length)
+{
+    byte *result = SCRATCH_ALLOC_MULTI(w, byte, length + 1);
+    if (pread(fd, result, length, offset) != (ssize_t) length) {
+        close(fd);
+        fail(w, JDEP_ERROR_IO, "unable to read jar file %s", jar->path);
+    }
+    return result;
+}
+
+/* Collect the names of the classes in a jar from its zip central directory,
+   without looking at (let alone decompressing) any of the entries. */
+  static void
+readJarClasses(Worker *w, JarInfo *jar)
+{
+    byte *tail, *eocd, *dir, *entry;
+    size_t tailLength;
+    uint64_t dirOffset, dirLength;
+    int classMax = 0;
+    int fd = open(jar->path, O_RDONLY);
+
+    if (fd < 0) {
+        fail(w, JDEP_ERROR_IO, "unable to open jar file %s", jar->path);
+    }
+
+    /* The end of central directory record is within the last 64K or so,
+       depending on the length of the trailing comment */
+    tailLength = jar->size < 65536 + 22 ? jar->size : 65536 + 22;
+    tail = readJarBytes(w, fd, jar, jar->size - tailLength, tailLength);
+    for (eocd = tail + tailLength - 22; eocd >= tail; --eocd) {
+        if (decodeLittleLong(eocd) == 0x06054b50) {
+            break;
+        }
+    }
+    if (eocd < tail) {
+        close(fd);
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a jar file", jar->path);
+    }
+    dirLength = decodeLittleLong(eocd + 12);
+    dirOffset = decodeLittleLong(eocd + 16);
+    if (dirOffset == 0xffffffff && eocd - tail >= 20 &&
+            decodeLittleLong(eocd - 20) == 0x07064b50) {
+        /* Zip64: the real numbers are in the zip64 end of directory record */
+        byte *eocd64 = readJarBytes(w, fd, jar, decodeLittleQuad(eocd - 12),
+                                    56);
+        dirLength = decodeLittleQuad(eocd64 + 40);
+        dirOffset = decodeLittleQuad(eocd64 + 48);
+    }
+
+    dir = readJarBytes(w, fd, jar, dirOffset, dirLength);
+    close(fd);
+    for (entry = dir; entry + 46 <= dir + dirLength &&
+             decodeLittleLong(entry) == 0x02014b50; ) {
+        int nameLength = decodeLittleWord(entry + 28);
+        char *name = (char *) entry + 46;
+        entry += 46 + nameLength + decodeLittleWord(entry + 30) +
+            decodeLittleWord(entry + 32);
+        if (entry > dir + dirLength) {
+            break;
+        }
+        if (nameLength > 6 && strncmp(name + nameLength - 6, ".class", 6) == 0) {
+            char *className;
+            if (strncmp(name, "META-INF/versions/", 18) == 0) {
+                /* Multi-release jar; the version just shadows a class */
+                char *slash = memchr(name + 18, '/', nameLength - 18);
+                if (!slash) {
+                    continue;
+                }
+                nameLength -= slash + 1 - name;
+                name = slash + 1;
+            }
+            if (jar->classCount == classMax) {
+                classMax = classMax ? classMax * 2 : 256;
+                jar->classes = TYPE_REALLOC_MULTI(w, char *, jar->classes,
+                                                  classMax);
+            }
+            className = TYPE_ALLOC_MULTI(w, char, nameLength - 5);
+            memcpy(className, name, nameLength - 6);
+            className[nameLength - 6] = '\0';
+            jar->classes[jar->classCount++] = className;
+        }
+    }
+}
+
+/* Hint that a file will be read soon, so the kernel can start reading it in
+   the background while we work on something else */
+  static void
+prefetchFile(char *path)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#endif
+}
+
+/* Get ready to examine class files, doing the setup that has to wait until
+   all the options are in */
+  static void
+prepareAnalysis(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+
+    if (!(ctx->flags & JDEP_ALL_PACKAGES) && !ctx->libraryPackagesExcluded) {
+        excludePackage(w, "java");
+        excludePackage(w, "javax");
+        excludePackage(w, "com.sun");
+        ctx->libraryPackagesExcluded = TRUE;
+    }
+    if (ctx->classPathLength > 0 && !ctx->jarClasses) {
+        indexJars(w);
+    }
+    if ((ctx->flags & JDEP_GRAPH) && !ctx->graph) {
+        ctx->graph = buildGraphBuilder(w);
+    }
+}
+
+/* Note the values of the constants defined by a class and its inner classes,
+   replacing whatever we previously knew about its source file. */
+  static void
+recordConstants(Worker *w, char *name, ConstantOwner *owner)
+{
+    jdep_context *ctx = w->ctx;
+    classFile *cf;
+    attribute_info *att;
+    int i;
+
+    if (hashLookup(ctx->constantClassesSeen, name)) {
+        return;
+    }
+    hashInsert(w, ctx->constantClassesSeen, name, 0);
+    if (!owner->refreshed) {
+        for (i = 0; i < owner->keyCount; ++i) {
+            FREE(w, owner->keys[i]);
+        }
+        owner->keyCount = 0;
+        owner->refreshed = TRUE;
+    }
+
+    cf = loadClassFile(w, name, NULL, 0);
+    for (att = cf->attributes; att; att = att->next) {
+        char *attName = getString(cf, att->attribute_name_index);
+        word flags = att->owner_flags;
+        if (attName && strcmp(attName, "ConstantValue") == 0 &&
+                (flags & (ACC_STATIC | ACC_FINAL)) ==
+                    (ACC_STATIC | ACC_FINAL) &&
+                !(flags & ACC_PRIVATE)) {
+            /* Only static finals are inlined, and another source file can
+               only see one that isn't private */
+            Input in;
+            char *key;
+            in.pos = att->info;
+            in.end = att->info + att->attribute_length;
+            in.filename = cf->filename;
+            key = literalKey(w, cf, readWord(w, &in));
+            if (key && (!(cf->access_flags & ACC_PUBLIC) ||
+                        !(flags & (ACC_PUBLIC | ACC_PROTECTED)))) {
+                char *packageKey = SCRATCH_ALLOC_MULTI(w, char,
+                                                       strlen(key) + 2);
+                packageKey[0] = PACKAGE_KEY_PREFIX;
+                strcpy(packageKey + 1, key);
+                key = packageKey;
+            }
+            if (key) {
+                addConstantKey(w, owner, key);
+            }
+        }
+    }
+    for (i = 0; i < cf->constant_pool_count; ++i) {
+        cp_info *cp = cf->constant_pool[i];
+        if (cp && cp->tag == CONSTANT_Class) {
+            char *inner = getClassName(w, cf, i);
+            char *dollar = inner ? index(inner, '$') : NULL;
+            /* Only classes nested in our own outer class, not in one whose
+               name just starts the same way */
+            if (dollar && inner[0] != '[' &&
+                    (int) strcspn(name, "$") == dollar - inner &&
+                    strncmp(inner, name, dollar-inner) == 0) {
+                recordConstants(w, inner, owner);
+            }
+        }
+    }
+}
+
+  static attribute_info *
+readAttributeInfo(Worker *w, Input *in, attribute_info *atts)
+{
+    word attribute_name_index = readWord(w, in);
+    longword attribute_length = readLong(w, in);
+    byte *info = readBytes(w, in, attribute_length);
+
+    return build_attribute_info(w, attribute_name_index, attribute_length,
+                                info, atts);
+}
+
+  static attribute_info *
+readAttributes(Worker *w, Input *in, int count, attribute_info *atts)
+{
+    int i;
+    for (i = 0; i < count; ++i) {
+        atts = readAttributeInfo(w, in, atts);
+    }
+    return atts;
+}
+
+  static byte
+readByte(Worker *w, Input *in)
+{
+    return *readBytes(w, in, 1);
+}
+
+/* Step over the next length bytes of the input, returning where they are */
+  static byte *
+readBytes(Worker *w, Input *in, size_t length)
+{
+    byte *result = in->pos;
+    if ((size_t) (in->end - in->pos) < length) {
+        fail(w, JDEP_ERROR_FORMAT, "class file %s is truncated",
+             in->filename);
+    }
+    in->pos += length;
+    return result;
+}
+
+  static classFile *
+readClassFile(Worker *w, Input *in)
+{
+    word access_flags;
+    word constant_pool_count;
+    cp_info **constant_pool;
+    attribute_info *atts = NULL;
+
+    if (readLong(w, in) != CLASS_MAGIC) {
+        fail(w, JDEP_ERROR_FORMAT, "%s is not a class file", in->filename);
+    }
+    readWord(w, in); /* minor_version */
+    readWord(w, in); /* major_version */
+    constant_pool_count = readWord(w, in);
+    constant_pool = readConstantPool(w, in, constant_pool_count);
+    access_flags = readWord(w, in);
+    readWord(w, in); /* this_class */
+    readWord(w, in); /* super_class */
+    word interfaces_count = readWord(w, in);
+    readBytes(w, in, interfaces_count * 2); /* interfaces */
+    word fields_count = readWord(w, in);
+    atts = readFields(w, in, fields_count, atts); /* fields */
+    word methods_count = readWord(w, in);
+    atts = readMethods(w, in, methods_count, atts); /* methods */
+    word attributes_count = readWord(w, in);
+    atts = readAttributes(w, in, attributes_count, atts);
+
+    return build_classFile(w, in->filename, access_flags,
+                           constant_pool_count, constant_pool, atts);
+}
+
+  static cp_info **
+readConstantPool(Worker *w, Input *in, int count)
+{
+    cp_info **result = SCRATCH_ALLOC_MULTI(w, cp_info *, count + 1);
+    int i;
+    result[0] = NULL;
+    for (i=1; i<count; ++i) {
+        result[i] = readConstantPoolInfo(w, in);
+        if (result[i] && (result[i]->tag == CONSTANT_Long ||
+                          result[i]->tag == CONSTANT_Double)) {
+            /* These take up two constant pool entries */
+            if (i + 1 < count) {
+                result[++i] = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+  static cp_info *
+readConstantPoolInfo(Worker *w, Input *in)
+{
+    byte tag = readByte(w, in);
+    switch (tag) {
+        case CONSTANT_Class:{
+            word name_index = readWord(w, in);
+            return (cp_info *) build_constant_class_info(w, name_index);
+        }
+        case CONSTANT_Fieldref:
+        case CONSTANT_Methodref:
+        case CONSTANT_InterfaceMethodref:{
+            word class_index = readWord(w, in);
+            word name_and_type_index = readWord(w, in);
+            return (cp_info *) build_constant_ref_info(w, tag, class_index,
+                                                       name_and_type_index);
+        }
+        case CONSTANT_String:{
+            word string_index = readWord(w, in);
+            return (cp_info *) build_constant_literal_info(w, tag, 0,
+                                                           string_index);
+        }
+        case CONSTANT_Integer:
+        case CONSTANT_Float:{
+            longword bytes = readLong(w, in);
+            return (cp_info *) build_constant_literal_info(w, tag, 0, bytes);
+        }
+        case CONSTANT_Long:
+        case CONSTANT_Double:{
+            longword high_bytes = readLong(w, in);
+            longword low_bytes = readLong(w, in);
+            return (cp_info *) build_constant_literal_info(w, tag, high_bytes,
+                                                           low_bytes);
+        }
+        case CONSTANT_NameAndType:{
+            word name_index = readWord(w, in);
+            word descriptor_index = readWord(w, in);
+            return (cp_info *) build_constant_nameandtype_info(w, name_index,
+                                                              descriptor_index);
+        }
+        case CONSTANT_Utf8:{
+            word length = readWord(w, in);
+            char *str = scratchString(w, (char *) readBytes(w, in, length),
+                                      length);
+            return (cp_info *) build_constant_utf8_info(w, str);
+        }
+        case CONSTANT_MethodHandle:{
+            readByte(w, in); /* reference_kind */
+            readWord(w, in); /* reference_index */
+            return NULL;
+        }
+        case CONSTANT_MethodType:{
+            readWord(w, in); /* descriptor_index */
+            return NULL;
+        }
+        case CONSTANT_InvokeDynamic:{
+            readWord(w, in); /* bootstrap_method_attr_index */
+            readWord(w, in); /* name_and_type_index */
+            return NULL;
+        }
+        default:
+            fail(w, JDEP_ERROR_FORMAT, "invalid constant pool tag %d in %s",
+                 tag, in->filename);
+    }
+    return NULL;
+}
+
+/* Class files are big-endian, whatever we are */
+  static longword
+readLong(Worker *w, Input *in)
+{
+    byte *buf = readBytes(w, in, 4);
+    return ((longword) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) |
+        buf[3];
+}
+
+  static word
+readWord(Worker *w, Input *in)
+{
+    byte *buf = readBytes(w, in, 2);
+    return (buf[0] << 8) | buf[1];
+}
+
+  static void *
+reallocate(Worker *w, void *ptr, size_t size)
+{
+    jdep_allocator *allocator = &w->ctx->allocator;
+    void *result = allocator->realloc(allocator->user, ptr, size ? size : 1);
+    if (!result) {
+        fail(w, JDEP_ERROR_MEMORY, "out of memory");
+    }
+    return result;
+}
+
+  static void
+release(Worker *w, void *ptr)
+{
+    if (ptr) {
+        w->ctx->allocator.free(w->ctx->allocator.user, ptr);
+    }
+}
+
+  static char *
+savePath(Worker *w, const char *path)
+{
+    int len = strlen(path);
+    char *result = TYPE_ALLOC_MULTI(w, char, len+2);
+    strcpy(result, path);
+    if (len > 0 && path[len-1] != '/') {
+        result[len] = '/';
+        result[len+1] = '\0';
+    }
+    return result;
+}
+
+  static char *
+saveString(Worker *w, const char *str)
+{
+    char *result = TYPE_ALLOC_MULTI(w, char, strlen(str) + 1);
+    strcpy(result, str);
+    return result;
+}
+
+  static void *
+scratchAlloc(Worker *w, size_t size)
+{
+    Chunk *chunk = w->scratch;
+    void *result;
+
+    size = (size + 15) & ~(size_t) 15;
+    if (!chunk || chunk->used + size > chunk->size) {
+        size_t chunkSize = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunk = (Chunk *) ALLOC(w, CHUNK_HEADER + chunkSize);
+        chunk->next = w->scratch;
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        w->scratch = chunk;
+    }
+    result = (char *) chunk + CHUNK_HEADER + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+/* Discard everything in scratch memory, keeping one chunk for next time */
+  static void
+scratchReset(Worker *w)
+{
+    Chunk *chunk = w->scratch;
+    Chunk *keep = NULL;
+
+    while (chunk) {
+        Chunk *next = chunk->next;
+        if (!keep && chunk->size == CHUNK_SIZE) {
+            keep = chunk;
+            keep->next = NULL;
+            keep->used = 0;
+        } else {
+            FREE(w, chunk);
+        }
+        chunk = next;
+    }
+    w->scratch = keep;
+}
+
+  static void
+unlockShared(Worker *w)
+{
+    if (w->locked) {
+        w->locked = FALSE;
+        pthread_mutex_unlock(&w->ctx->lock);
+    }
+}
+
+  static char *
+scratchString(Worker *w, const char *str, size_t length)
+{
+    char *result = SCRATCH_ALLOC_MULTI(w, char, length + 1);
+    memcpy(result, str, length);
+    result[length] = '\0';
+    return result;
+}
+
+  static attribute_info *
+readFieldInfo(Worker *w, Input *in, attribute_info *atts)
+{
+    word access_flags = readWord(w, in);
+    readWord(w, in); /* name_index */
+    readWord(w, in); /* descriptor_index */
+    word attributes_count = readWord(w, in);
+    attribute_info *result = readAttributes(w, in, attributes_count, atts);
+    attribute_info *att;
+
+    for (att = result; att != atts; att = att->next) {
+        att->owner_flags = access_flags;
+    }
+    return result;
+}
+
+  static attribute_info *
+readFields(Worker *w, Input *in, int count, attribute_info *atts)
+{
+    int i;
+    for (i=0; i<count; ++i) {
+        atts = readFieldInfo(w, in, atts);
+    }
+    return atts;
+}
+
+/* Read a line (newline and all) from w->input into buf, returning NULL at
+   the end of the file */
+  static char *
+readLine(Worker *w, StringBuffer *buf)
+{
+    int c;
+
+    buf->length = 0;
+    while ((c = getc(w->input)) != EOF) {
+        appendChar(w, buf, c);
+        if (c == '\n') {
+            break;
+        }
+    }
+    return buf->length > 0 ? buf->data : NULL;
+}
+
+  static attribute_info *
+readMethodInfo(Worker *w, Input *in, attribute_info *atts)
+{
+    readWord(w, in); /* access_flags */
+    readWord(w, in); /* name_index */
+    readWord(w, in); /* descriptor_index */
+    word attributes_count = readWord(w, in);
+    return readAttributes(w, in, attributes_count, atts);
+}
+
+  static attribute_info *
+readMethods(Worker *w, Input *in, int count, attribute_info *atts)
+{
+    int i;
+    for (i = 0; i < count; ++i) {
+        atts = readMethodInfo(w, in, atts);
+    }
+    return atts;
+}
+
+/* Bring a file's timestamps up to date, creating it and any missing
+   directories on its path if need be (i.e., "touch" plus "mkdir -p"). */
+  static void
+touchFile(Worker *w, char *path)
+{
+    char *end = rindex(path, '/');
+    int fd;
+
+    if (utimensat(AT_FDCWD, path, NULL, 0) == 0) {
+        return;
+    }
+    if (errno != ENOENT) {
+        fail(w, JDEP_ERROR_IO, "unable to touch %s", path);
+    }
+    if (end) {
+        *end = '\0';
+        mkdirPath(w, path);
+        *end = '/';
+    }
+    fd = open(path, O_WRONLY | O_CREAT, 0666);
+    if (fd < 0) {
+        fail(w, JDEP_ERROR_IO, "unable to create %s", path);
+    }
+    close(fd);
+}
+
+/* Save what we know about the constants defined by each class */
+  static void
+writeConstantIndex(Worker *w, char *filename)
+{
+    jdep_context *ctx = w->ctx;
+    FILE *fyle = fopenPath(w, filename);
+    int i, j;
+
+    if (!fyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open constant index file %s",
+             filename);
+    }
+    if (ctx->constantOwnerCount > 0) {
+        qsort(ctx->constantOwners, ctx->constantOwnerCount,
+              sizeof(ConstantOwner *), compareConstantOwners);
+    }
+    for (i = 0; i < ctx->constantOwnerCount; ++i) {
+        /* Sorting moved the owners around */
+        hashLookup(ctx->constantOwnerIds, ctx->constantOwners[i]->name)->value
+            = i;
+    }
+    fprintf(fyle, "%s", CONSTANT_INDEX_HEADER);
+    for (i = 0; i < ctx->constantOwnerCount; ++i) {
+        ConstantOwner *owner = ctx->constantOwners[i];
+        if (owner->keyCount > 0) {
+            fprintf(fyle, "%s\n", owner->name);
+            qsort(owner->keys, owner->keyCount, sizeof(char *), compareNames);
+            for (j = 0; j < owner->keyCount; ++j) {
+                fprintf(fyle, " %s\n", owner->keys[j]);
+            }
+        }
+    }
+    fclose(fyle);
+}
+
+/* Save the class lists of the jars we know about, leaving out any jars that
+   have since been deleted. */
+  static void
+writeJarIndex(Worker *w, char *filename)
+{
+    struct stat st;
+    JarInfo *jar;
+    FILE *fyle = fopenPath(w, filename);
+    int i;
+
+    if (!fyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open jar index file %s", filename);
+    }
+    fprintf(fyle, "%s", JAR_INDEX_HEADER);
+    for (jar = w->ctx->jars; jar; jar = jar->next) {
+        if (jar->onClassPath || stat(jar->path, &st) == 0) {
+            fprintf(fyle, "jar %lld %lld %d %s\n", (long long) jar->mtime,
+                    (long long) jar->size, jar->classCount, jar->path);
+            for (i = 0; i < jar->classCount; ++i) {
+                fprintf(fyle, " %s\n", jar->classes[i]);
+            }
+        }
+    }
+    fclose(fyle);
+}
+
+/* Write the .d files for a batch of classes, replacing each group of two or
+   more prerequisites that are used by exactly the same classes (such as the
+   sources of a few classes that nearly everything else uses) by a stamp file
+   that depends on the group, whenever that makes for fewer dependencies in
+   all.  A class depends on the stamp just when it would have depended on
+   every prerequisite in the group, so make reaches the same decisions.
+
+   Every class depends on its own source, which would make the users of each
+   source in the batch different from those of any other, so a class is left
+   out of the users of its own source and depends on it directly.  The
+   exception is a source in a cycle of sources, where each class is left in:
+   the sources of classes that all use one another then have the same users
+   and share a stamp. */
+  static void
+writeReducedDepFiles(Worker *w)
+{
+    jdep_context *ctx = w->ctx;
+    GraphBuilder *batch = ctx->batch;
+    int prereqCount = batch->nodeCount;
+    int classCount = ctx->batchClasses.count;
+    PrereqUsers *groups = SCRATCH_ALLOC_MULTI(w, PrereqUsers, prereqCount + 1);
+    uint32_t *users = SCRATCH_ALLOC_MULTI(w, uint32_t, batch->edgeCount + 1);
+    int *stampOf = SCRATCH_ALLOC_MULTI(w, int, prereqCount + 1);
+    char **stamps = SCRATCH_ALLOC_MULTI(w, char *, prereqCount / 2 + 1);
+    int *lastUser = SCRATCH_ALLOC_MULTI(w, int, prereqCount / 2 + 1);
+    int *ownSource = SCRATCH_ALLOC_MULTI(w, int, classCount + 1);
+    bool *direct = SCRATCH_ALLOC_MULTI(w, bool, prereqCount + 1);
+    uint32_t *sourceRow = SCRATCH_ALLOC_MULTI(w, uint32_t, prereqCount + 2);
+    uint32_t *sourceEdges = SCRATCH_ALLOC_MULTI(w, uint32_t,
+                                                batch->edgeCount + 1);
+    int *component = SCRATCH_ALLOC_MULTI(w, int, prereqCount + 1);
+    int *componentSize;
+    int componentCount;
+    int stampCount = 0;
+    char target[1000];
+    int i, j, edge;
+
+    /* Find each class's own source among the prerequisites, and the graph of
+       which sources use which */
+    for (i = 0; i < classCount; ++i) {
+        char *name = ctx->batchClasses.items[i];
+        HashEntry *entry;
+        formatPath(w, target, sizeof(target), "%s%.*s.java", ctx->javaRoot,
+                   outerLength(name), name);
+        entry = hashLookup(batch->ids, target);
+        ownSource[i] = entry ? entry->value : -1;
+    }
+    for (i = 0; i < prereqCount + 2; ++i) {
+        sourceRow[i] = 0;
+    }
+    for (edge = 0; edge < batch->edgeCount; ++edge) {
+        int source = ownSource[batch->edges[edge * 2]];
+        if (source >= 0 && (int) batch->edges[edge * 2 + 1] != source) {
+            ++sourceRow[source + 2];
+        }
+    }
+    for (i = 2; i < prereqCount + 2; ++i) {
+        sourceRow[i] += sourceRow[i - 1];
+    }
+    for (edge = 0; edge < batch->edgeCount; ++edge) {
+        int source = ownSource[batch->edges[edge * 2]];
+        if (source >= 0 && (int) batch->edges[edge * 2 + 1] != source) {
+            sourceEdges[sourceRow[source + 1]++] = batch->edges[edge * 2 + 1];
+        }
+    }
+    componentCount = findComponents(w, prereqCount, sourceRow, sourceEdges,
+                                    component);
+    componentSize = SCRATCH_ALLOC_MULTI(w, int, componentCount + 1);
+    for (i = 0; i < componentCount; ++i) {
+        componentSize[i] = 0;
+    }
+    for (i = 0; i < prereqCount; ++i) {
+        ++componentSize[component[i]];
+        direct[i] = FALSE;
+    }
+    for (i = 0; i < classCount; ++i) {
+        if (ownSource[i] >= 0) {
+            direct[ownSource[i]] = componentSize[component[ownSource[i]]] == 1;
+        }
+    }
+
+    /* Collect the users of each prerequisite; since the edges were added a
+       class at a time, each list comes out in ascending order */
+    for (i = 0; i < prereqCount; ++i) {
+        groups[i].count = 0;
+        groups[i].prereq = i;
+        stampOf[i] = -1;
+    }
+    for (edge = 0; edge < batch->edgeCount; ++edge) {
+        int prereq = batch->edges[edge * 2 + 1];
+        if (!direct[prereq] || ownSource[batch->edges[edge * 2]] != prereq) {
+            ++groups[prereq].count;
+        }
+    }
+    for (i = 0, j = 0; i < prereqCount; ++i) {
+        groups[i].users = &users[j];
+        j += groups[i].count;
+        groups[i].count = 0;
+    }
+    for (edge = 0; edge < batch->edgeCount; ++edge) {
+        int prereq = batch->edges[edge * 2 + 1];
+        if (!direct[prereq] || ownSource[batch->edges[edge * 2]] != prereq) {
+            PrereqUsers *group = &groups[prereq];
+            group->users[group->count++] = batch->edges[edge * 2];
+        }
+    }
+    for (i = 0; i < prereqCount; ++i) {
+        /* FNV-1a again */
+        unsigned int signature = 2166136261u;
+        for (j = 0; j < (int) groups[i].count; ++j) {
+            signature = (signature ^ groups[i].users[j]) * 16777619u;
+        }
+        groups[i].signature = signature;
+    }
+    qsort(groups, prereqCount, sizeof(PrereqUsers), comparePrereqUsers);
+
+    for (i = 0; i < prereqCount; i = j) {
+        int size, userCount = groups[i].count;
+        for (j = i + 1; j < prereqCount; ++j) {
+            if (groups[j].signature != groups[i].signature ||
+                    groups[j].count != groups[i].count ||
+                    memcmp(groups[j].users, groups[i].users,
+                           sizeof(uint32_t) * userCount) != 0) {
+                break;
+            }
+        }
+        size = j - i;
+        if (size >= 2 && size * userCount > size + userCount) {
+            char **members = SCRATCH_ALLOC_MULTI(w, char *, size);
+            char path[1000];
+            unsigned long long hash = 14695981039346656037ull;
+            int k;
+            for (k = 0; k < size; ++k) {
+                members[k] = batch->names[groups[i + k].prereq];
+                stampOf[groups[i + k].prereq] = stampCount;
+            }
+            /* The stamp is named for its members, so that every batch that
+               comes up with the same group uses the same stamp */
+            qsort(members, size, sizeof(char *), compareNames);
+            for (k = 0; k < size; ++k) {
+                char *p;
+                for (p = members[k]; *p; ++p) {
+                    hash = (hash ^ (byte) *p) * 1099511628211ull;
+                }
+                hash = (hash ^ '\n') * 1099511628211ull;
+            }
+            formatPath(w, path, sizeof(path), "%s" STAMP_DIR "%016llx.stamp",
+                       ctx->depRoot, hash);
+            stamps[stampCount] = scratchString(w, path, strlen(path));
+            lastUser[stampCount++] = -1;
+            writeStamp(w, stamps[stampCount - 1], members, size);
+        }
+    }
+
+    edge = 0;
+    for (i = 0; i < classCount; ++i) {
+        char *name = ctx->batchClasses.items[i];
+        w->prereqs.count = 0;
+        for (; edge < batch->edgeCount && (int) batch->edges[edge * 2] == i;
+                ++edge) {
+            int prereq = batch->edges[edge * 2 + 1];
+            int stamp = stampOf[prereq];
+            if (stamp < 0 || (direct[prereq] && ownSource[i] == prereq)) {
+                listAdd(w, &w->prereqs, batch->names[prereq]);
+            } else if (lastUser[stamp] != i) {
+                lastUser[stamp] = i;
+                listAdd(w, &w->prereqs, stamps[stamp]);
+            }
+        }
+        formatPath(w, target, sizeof(target), "%s%s.class", ctx->classRoot,
+                   name);
+        writeDepFile(w, name, target);
+    }
+}
+
+/* Write the rule for a stamp file, unless an earlier batch already did, and
+   make sure the stamp is no older than its prerequisites; being no newer
+   either, it doesn't cause anything that depended on them directly to be
+   rebuilt. */
+  static void
+writeStamp(Worker *w, char *path, char **prereqs, int count)
+{
+    char rulefilename[1000];
+    struct timespec times[2];
+    struct stat st;
+    FILE *outfyle;
+    int i;
+
+    formatPath(w, rulefilename, sizeof(rulefilename), "%.*s.d",
+               (int) (strlen(path) - strlen(".stamp")), path);
+    if (access(rulefilename, F_OK) != 0) {
+        outfyle = fopenPath(w, rulefilename);
+        if (!outfyle) {
+            fail(w, JDEP_ERROR_IO, "unable to open output file %s",
+                 rulefilename);
+        }
+        fprintf(outfyle, "%s: \\\n", path);
+        for (i = 0; i < count; ++i) {
+            fprintf(outfyle, "  %s\\\n", prereqs[i]);
+        }
+        fprintf(outfyle, "\n\ttouch $@\n");
+        fclose(outfyle);
+    }
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = 0;
+    for (i = 0; i < count; ++i) {
+        if (stat(prereqs[i], &st) == 0 &&
+                (st.st_mtim.tv_sec > times[0].tv_sec ||
+                 (st.st_mtim.tv_sec == times[0].tv_sec &&
+                  st.st_mtim.tv_nsec > times[0].tv_nsec))) {
+            times[0] = st.st_mtim;
+        }
+    }
+    times[1] = times[0];
+    if (stat(path, &st) == 0) {
+        if (st.st_mtim.tv_sec > times[0].tv_sec ||
+                (st.st_mtim.tv_sec == times[0].tv_sec &&
+                 st.st_mtim.tv_nsec >= times[0].tv_nsec)) {
+            return;
+        }
+    } else {
+        touchFile(w, path);
+    }
+    if (utimensat(AT_FDCWD, path, times, 0) != 0) {
+        fail(w, JDEP_ERROR_IO, "unable to touch %s", path);
+    }
+}
+
+/* Write the dyndep file.  jdep normally only sees the classes that were just
+   recompiled, but Ninja requires the dyndep file to mention every output
+   that uses it, so the statements for classes outside the batch are carried
+   over from the existing file. */
+  static void
+writeDyndepFile(Worker *w, DyndepInfo *dyndeps, char *filename)
+{
+    StringBuffer buf = { NULL, 0, 0 };
+    FILE *fyle;
+    char *line;
+    int i;
+
+    w->input = fopen(filename, "r");
+    if (w->input) {
+        while ((line = readLine(w, &buf))) {
+            char *end;
+            if (strncmp(line, "build ", 6) != 0) {
+                continue;
+            }
+            for (end = line + 6; *end && *end != ':'; ++end) {
+                if (*end == '$' && end[1]) {
+                    ++end;
+                }
+            }
+            if (*end == ':') {
+                *end = '\0';
+                if (!hashLookup(dyndeps->targets, line + 6)) {
+                    char *target = scratchString(w, line + 6, end - line - 6);
+                    int length = strlen(end + 1);
+                    char *kept = TYPE_ALLOC_MULTI(w, char,
+                                                  end - line + length + 3);
+                    *end = ':';
+                    strcpy(kept, line);
+                    if (length == 0 || end[length] != '\n') {
+                        /* The last line of the file might lack a newline */
+                        strcat(kept, "\n");
+                    }
+                    w->pending = kept;
+                    addDyndep(w, dyndeps, target, kept);
+                    w->pending = NULL;
+                }
+            }
+        }
+        fclose(w->input);
+        w->input = NULL;
+        scratchReset(w);
+    }
+
+    if (dyndeps->count > 0) {
+        qsort(dyndeps->lines, dyndeps->count, sizeof(char *), compareNames);
+    }
+    fyle = fopenPath(w, filename);
+    if (!fyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open dyndep file %s", filename);
+    }
+    fprintf(fyle, "ninja_dyndep_version = 1\n");
+    for (i = 0; i < dyndeps->count; ++i) {
+        fprintf(fyle, "%s", dyndeps->lines[i]);
+    }
+    fclose(fyle);
+
+    /* Sorting moved the lines around */
+    for (i = 0; i < dyndeps->count; ++i) {
+        for (line = dyndeps->lines[i] + 6; *line && *line != ':'; ++line) {
+            if (*line == '$' && line[1]) {
+                ++line;
+            }
+        }
+        *line = '\0';
+        hashLookup(dyndeps->targets, dyndeps->lines[i] + 6)->value = i;
+        *line = ':';
+    }
+}
+
+  static void
+writeGraphBinary(const Graph *graph, FILE *outfyle)
+{
+    GraphHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAPH_MAGIC, sizeof(header.magic));
+    header.byteOrder = GRAPH_BYTE_ORDER;
+    header.version = GRAPH_VERSION;
+    header.nodeCount = graph->nodeCount;
+    header.edgeCount = graph->edgeCount;
+    header.nameBytes = graph->nameBytes;
+    fwrite(&header, sizeof(header), 1, outfyle);
+    fwrite(graph->rowStart, sizeof(uint32_t), graph->nodeCount + 1, outfyle);
+    fwrite(graph->edges, sizeof(uint32_t), graph->edgeCount, outfyle);
+    fwrite(graph->nameStart, sizeof(uint32_t), graph->nodeCount, outfyle);
+    fwrite(graph->names, 1, graph->nameBytes, outfyle);
+}
+
+  static void
+writeQuoted(char *str, FILE *outfyle)
+{
+    putc('"', outfyle);
+    while (*str) {
+        byte c = *str++;
+        if (c == '"' || c == '\\') {
+            fprintf(outfyle, "\\%c", c);
+        } else if (c < ' ') {
+            fprintf(outfyle, "\\u%04x", c);
+        } else {
+            putc(c, outfyle);
+        }
+    }
+    putc('"', outfyle);
+}
+
+  static void
+writeGraphDot(const Graph *graph, FILE *outfyle)
+{
+    uint32_t i, j;
+
+    fprintf(outfyle, "digraph jdep {\n");
+    for (i = 0; i < graph->nodeCount; ++i) {
+        fprintf(outfyle, "  ");
+        writeQuoted(&graph->names[graph->nameStart[i]], outfyle);
+        fprintf(outfyle, ";\n");
+    }
+    for (i = 0; i < graph->nodeCount; ++i) {
+        for (j = graph->rowStart[i]; j < graph->rowStart[i + 1]; ++j) {
+            fprintf(outfyle, "  ");
+            writeQuoted(&graph->names[graph->nameStart[i]], outfyle);
+            fprintf(outfyle, " -> ");
+            writeQuoted(&graph->names[graph->nameStart[graph->edges[j]]],
+                        outfyle);
+            fprintf(outfyle, ";\n");
+        }
+    }
+    fprintf(outfyle, "}\n");
+}
+
+  static void
+writeGraphJson(const Graph *graph, FILE *outfyle)
+{
+    uint32_t i;
+
+    fprintf(outfyle, "{\n  \"nodes\": [");
+    for (i = 0; i < graph->nodeCount; ++i) {
+        fprintf(outfyle, i ? ",\n    " : "\n    ");
+        writeQuoted(&graph->names[graph->nameStart[i]], outfyle);
+    }
+    fprintf(outfyle, "\n  ],\n  \"rowStart\": [");
+    for (i = 0; i <= graph->nodeCount; ++i) {
+        fprintf(outfyle, i ? ", %u" : "%u", graph->rowStart[i]);
+    }
+    fprintf(outfyle, "],\n  \"edges\": [");
+    for (i = 0; i < graph->edgeCount; ++i) {
+        fprintf(outfyle, i ? ", %u" : "%u", graph->edges[i]);
+    }
+    fprintf(outfyle, "]\n}\n");
+}
+
+/* Write a graph in the format implied by the output file name: ".json" for
+   JSON, ".dot" for Graphviz, and the mmap-able binary form for anything
+   else. */
+  static void
+writeGraph(Worker *w, const Graph *graph, char *filename)
+{
+    char *suffix = rindex(filename, '.');
+    FILE *outfyle = fopenPath(w, filename);
+    struct stat st;
+    bool regular;
+
+    if (!outfyle) {
+        fail(w, JDEP_ERROR_IO, "unable to open graph file %s", filename);
+    }
+    regular = fstat(fileno(outfyle), &st) == 0 && S_ISREG(st.st_mode);
+    if (suffix && strcmp(suffix, ".json") == 0) {
+        writeGraphJson(graph, outfyle);
+    } else if (suffix && strcmp(suffix, ".dot") == 0) {
+        writeGraphDot(graph, outfyle);
+    } else {
+        writeGraphBinary(graph, outfyle);
+    }
+    if (ferror(outfyle) | (fclose(outfyle) != 0)) {
+        /* Don't leave a truncated graph around for -G to trip over */
+        if (regular) {
+            unlink(filename);
+        }
+        fail(w, JDEP_ERROR_IO, "unable to write graph file %s", filename);
+    }
+}
+
+/* Partitioning.  The graph's classes are first gathered up into their
+   source files, since that's what gets compiled, and the source files into
+   strongly connected components, since the members of a cycle have to be
+   compiled together.  The components are dealt out to the shards in
+   dependency order, in contiguous runs of roughly equal weight, and then
+   moved between shards, one at a time, wherever that cuts more edges than it
+   adds without overloading the shard moved to, or (at the least cost in
+   edges) to take the load off a shard that is overloaded already. */
+typedef struct Partition {
+    int sourceCount;
+    char **sources;             /* outer class names, in name order */
+    int *sourceOf;              /* graph node -> source */
+    uint32_t *sourceRow;        /* dependencies between sources, in CSR */
+    uint32_t *sourceEdges;
+    uint64_t *sourceWeight;
+    int componentCount;
+    int *component;             /* source -> component */
+    uint64_t *componentWeight;
+    uint32_t *componentRow;     /* edges between components, both ways */
+    uint32_t *componentEdges;
+    int *shard;                 /* component -> shard */
+} Partition;
+
+/* Allowed overweight of a shard during refinement, in percent */
+#define PARTITION_SLACK         5
+#define PARTITION_PASSES        8
+
+/* The length of the outer class part of a class name */
+  static int
+outerLength(const char *name)
+{
+    return strcspn(name, "$");
+}
+
+/* Number the strongly connected components of the n-node graph whose edges
+   are given in CSR form by row and edges, putting each node's component in
+   component and returning how many there are.  This is Tarjan's algorithm
+   (without recursion, since the dependency chains can be long); components
+   are completed, and so numbered, dependencies first. */
+  static int
+findComponents(Worker *w, int n, uint32_t *row, uint32_t *edges,
+               int *component)
+{
+    int *order = SCRATCH_ALLOC_MULTI(w, int, n + 1);
+    int *low = SCRATCH_ALLOC_MULTI(w, int, n + 1);
+    int *stack = SCRATCH_ALLOC_MULTI(w, int, n + 1);
+    int *calls = SCRATCH_ALLOC_MULTI(w, int, n + 1);
+    uint32_t *next = SCRATCH_ALLOC_MULTI(w, uint32_t, n + 1);
+    int counter = 0;
+    int count = 0;
+    int top = 0;
+    int root, i;
+
+    for (i = 0; i < n; ++i) {
+        order[i] = -1;
+        component[i] = -1;
+    }
+    for (root = 0; root < n; ++root) {
+        int depth = 0;
+        if (order[root] >= 0) {
+            continue;
+        }
+        order[root] = low[root] = counter++;
+        next[root] = row[root];
+        stack[top++] = root;
+        calls[depth++] = root;
+        while (depth > 0) {
+            int v = calls[depth - 1];
+            if (next[v] < row[v + 1]) {
+                int u = edges[next[v]++];
+                if (order[u] < 0) {
+                    order[u] = low[u] = counter++;
+                    next[u] = row[u];
+                    stack[top++] = u;
+                    calls[depth++] = u;
+                } else if (component[u] < 0 && order[u] < low[v]) {
+                    /* u is still on the stack */
+                    low[v] = order[u];
+                }
+            } else {
+                --depth;
+                if (depth > 0 && low[v] < low[calls[depth - 1]]) {
+                    low[calls[depth - 1]] = low[v];
+                }
+                if (low[v] == order[v]) {
+                    int u;
+                    do {
+                        u = stack[--top];
+                        component[u] = count;
+                    } while (u != v);
+                    ++count;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/* Weigh each source by the total size of its class files, outer and inner,
+   as a stand-in for the cost of compiling it.  Each directory of the class
+   root is read just once. */
+  static void
+weighSources(Worker *w, Partition *part)
+{
+    char *classRoot = w->ctx->classRoot;
+    char **dirs = SCRATCH_ALLOC_MULTI(w, char *, part->sourceCount + 1);
+    int dirCount = 0;
+    int i;
+
+    for (i = 0; i < part->sourceCount; ++i) {
+        char *slash = rindex(part->sources[i], '/');
+        int length = slash ? slash - part->sources[i] : 0;
+        dirs[dirCount++] = scratchString(w, part->sources[i], length);
+        part->sourceWeight[i] = 0;
+    }
+    qsort(dirs, dirCount, sizeof(char *), compareNames);
+    for (i = 0; i < dirCount; ++i) {
+        char path[1000];
+        struct dirent *entry;
+        DIR *dyr;
+
+        if (i > 0 && strcmp(dirs[i], dirs[i - 1]) == 0) {
+            continue;
+        }
+        formatPath(w, path, sizeof(path), "%s%s", classRoot,
+                   dirs[i][0] ? dirs[i] : ".");
+        dyr = opendir(path);
+        if (!dyr) {
+            continue;
+        }
+        while ((entry = readdir(dyr))) {
+            int length = strlen(entry->d_name);
+            char name[1000];
+            char *key = name;
+            char **found;
+            struct stat st;
+
+            if (length < 7 || strcmp(entry->d_name + length - 6, ".class")) {
+                continue;
+            }
+            if (snprintf(name, sizeof(name), "%s%s%.*s", dirs[i],
+                         dirs[i][0] ? "/" : "",
+                         outerLength(entry->d_name) < length - 6 ?
+                             outerLength(entry->d_name) : length - 6,
+                         entry->d_name) >= (int) sizeof(name) ||
+                    snprintf(path, sizeof(path), "%s%s%s%s", classRoot,
+                             dirs[i], dirs[i][0] ? "/" : "",
+                             entry->d_name) >= (int) sizeof(path)) {
+                /* Let go of the directory before giving up */
+                char *tooLong = scratchString(w, entry->d_name, length);
+                closedir(dyr);
+                fail(w, JDEP_ERROR_ARGUMENT, "path too long: %.200s%s/%s",
+                     classRoot, dirs[i], tooLong);
+            }
+            found = (char **) bsearch(&key, part->sources, part->sourceCount,
+                                      sizeof(char *), compareNames);
+            if (found && stat(path, &st) == 0) {
+                part->sourceWeight[found - part->sources] += st.st_size;
+            }
+        }
+        closedir(dyr);
+    }
+    for (i = 0; i < part->sourceCount; ++i) {
+        if (part->sourceWeight[i] == 0) {
+            /* No class files; it still has to be compiled somewhere */
+            part->sourceWeight[i] = 1;
+        }
+    }
+}
+
+/* Collapse the class graph into the graph of source files */
+  static void
+buildSourceGraph(Worker *w, const Graph *graph, Partition *part)
+{
+    int n = graph->nodeCount;
+    uint32_t edge;
+    int i;
+
+    part->sources = SCRATCH_ALLOC_MULTI(w, char *, n + 1);
+    part->sourceOf = SCRATCH_ALLOC_MULTI(w, int, n + 1);
+    part->sourceCount = 0;
+    for (i = 0; i < n; ++i) {
+        /* Inner classes sort right after their outer classes */
+        char *name = &graph->names[graph->nameStart[i]];
+        int length = outerLength(name);
+        int last = part->sourceCount - 1;
+        if (last < 0 || (int) strlen(part->sources[last]) != length ||
+                strncmp(part->sources[last], name, length) != 0) {
+            part->sources[++last] = scratchString(w, name, length);
+            part->sourceCount = last + 1;
+        }
+        part->sourceOf[i] = last;
+    }
+
+    part->sourceRow = SCRATCH_ALLOC_MULTI(w, uint32_t, part->sourceCount + 1);
+    part->sourceEdges = SCRATCH_ALLOC_MULTI(w, uint32_t, graph->edgeCount + 1);
+    memset(part->sourceRow, 0, sizeof(uint32_t) * (part->sourceCount + 1));
+    for (i = 0; i < n; ++i) {
+        for (edge = graph->rowStart[i]; edge < graph->rowStart[i + 1]; ++edge) {
+            if (part->sourceOf[graph->edges[edge]] != part->sourceOf[i]) {
+                ++part->sourceRow[part->sourceOf[i] + 1];
+            }
+        }
+    }
+    for (i = 0; i < part->sourceCount; ++i) {
+        part->sourceRow[i + 1] += part->sourceRow[i];
+    }
+    /* The rows are filled in order, since nodes of a source are adjacent */
+    edge = 0;
+    for (i = 0; i < n; ++i) {
+        uint32_t j;
+        for (j = graph->rowStart[i]; j < graph->rowStart[i + 1]; ++j) {
+            int to = part->sourceOf[graph->edges[j]];
+            if (to != part->sourceOf[i]) {
+                part->sourceEdges[edge++] = to;
+            }
+        }
+    }
+    part->sourceWeight = SCRATCH_ALLOC_MULTI(w, uint64_t,
+                                             part->sourceCount + 1);
+}
+
+/* Connect the components up, ignoring the direction of the dependencies
+   since an edge costs the same whichever way it crosses shards */
+  static void
+buildComponentGraph(Worker *w, Partition *part)
+{
+    int count = part->componentCount;
+    uint32_t *fill = SCRATCH_ALLOC_MULTI(w, uint32_t, count + 1);
+    uint32_t edge;
+    int i;
+
+    part->componentWeight = SCRATCH_ALLOC_MULTI(w, uint64_t, count + 1);
+    part->componentRow = SCRATCH_ALLOC_MULTI(w, uint32_t, count + 1);
+    part->componentEdges = SCRATCH_ALLOC_MULTI(w, uint32_t,
+        (size_t) part->sourceRow[part->sourceCount] * 2 + 1);
+    memset(part->componentWeight, 0, sizeof(uint64_t) * count);
+    memset(part->componentRow, 0, sizeof(uint32_t) * (count + 1));
+    for (i = 0; i < part->sourceCount; ++i) {
+        int from = part->component[i];
+        part->componentWeight[from] += part->sourceWeight[i];
+        for (edge = part->sourceRow[i]; edge < part->sourceRow[i + 1]; ++edge) {
+            int to = part->component[part->sourceEdges[edge]];
+            if (to != from) {
+                ++part->componentRow[from + 1];
+                ++part->componentRow[to + 1];
+            }
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        part->componentRow[i + 1] += part->componentRow[i];
+    }
+    memcpy(fill, part->componentRow, sizeof(uint32_t) * count);
+    for (i = 0; i < part->sourceCount; ++i) {
+        int from = part->component[i];
+        for (edge = part->sourceRow[i]; edge < part->sourceRow[i + 1]; ++edge) {
+            int to = part->component[part->sourceEdges[edge]];
+            if (to != from) {
+                part->componentEdges[fill[from]++] = to;
+                part->componentEdges[fill[to]++] = from;
+            }
+        }
+    }
+}
+
+/* Deal out the components, then improve on the deal */
+  static void
+assignShards(Worker *w, Partition *part, int shardCount)
+{
+    int count = part->componentCount;
+    uint64_t *shardWeight = SCRATCH_ALLOC_MULTI(w, uint64_t, shardCount);
+    int *shardSize = SCRATCH_ALLOC_MULTI(w, int, shardCount);
+    int *links = SCRATCH_ALLOC_MULTI(w, int, shardCount);
+    int *touched = SCRATCH_ALLOC_MULTI(w, int, shardCount);
+    uint64_t total = 0;
+    uint64_t sofar = 0;
+    uint64_t limit;
+    int pass, c, i;
+
+    part->shard = SCRATCH_ALLOC_MULTI(w, int, count + 1);
+    memset(shardWeight, 0, sizeof(uint64_t) * shardCount);
+    memset(shardSize, 0, sizeof(int) * shardCount);
+    memset(links, 0, sizeof(int) * shardCount);
+    for (c = 0; c < count; ++c) {
+        total += part->componentWeight[c];
+    }
+
+    /* Each component goes to the shard its midpoint falls in, so that
+       components that depend on one another tend to end up together */
+    for (c = 0; c < count; ++c) {
+        uint64_t middle = sofar + part->componentWeight[c] / 2;
+        int shard = total ? (int) (middle * shardCount / total) : 0;
+        if (shard >= shardCount) {
+            shard = shardCount - 1;
+        }
+        part->shard[c] = shard;
+        shardWeight[shard] += part->componentWeight[c];
+        ++shardSize[shard];
+        sofar += part->componentWeight[c];
+    }
+
+    limit = total / shardCount * (100 + PARTITION_SLACK) / 100;
+    for (pass = 0; pass < PARTITION_PASSES; ++pass) {
+        int moved = 0;
+        for (c = 0; c < count; ++c) {
+            int from = part->shard[c];
+            int best = from;
+            int bestGain = 0;
+            int touchedCount = 0;
+            uint32_t edge;
+
+            for (edge = part->componentRow[c];
+                     edge < part->componentRow[c + 1]; ++edge) {
+                int shard = part->shard[part->componentEdges[edge]];
+                if (links[shard]++ == 0) {
+                    touched[touchedCount++] = shard;
+                }
+            }
+            if (shardWeight[from] > limit && shardSize[from] > 1) {
+                /* Any shard with room will do, even at a cost in edges */
+                bestGain = INT_MIN;
+                for (i = 0; i < shardCount; ++i) {
+                    int gain = links[i] - links[from];
+                    if (i != from && gain > bestGain &&
+                            shardWeight[i] + part->componentWeight[c] <=
+                                limit) {
+                        best = i;
+                        bestGain = gain;
+                    }
+                }
+            } else if (shardSize[from] > 1) {
+                for (i = 0; i < touchedCount; ++i) {
+                    int shard = touched[i];
+                    int gain = links[shard] - links[from];
+                    if (shard != from && gain > bestGain &&
+                            shardWeight[shard] + part->componentWeight[c] <=
+                                limit) {
+                        best = shard;
+                        bestGain = gain;
+                    }
+                }
+            }
+            for (i = 0; i < touchedCount; ++i) {
+                links[touched[i]] = 0;
+            }
+            if (best != from) {
+                part->shard[c] = best;
+                shardWeight[from] -= part->componentWeight[c];
+                shardWeight[best] += part->componentWeight[c];
+                --shardSize[from];
+                ++shardSize[best];
+                ++moved;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+    }
+}
+
+  static void
+partitionGraph(Worker *w, const Graph *graph, int shardCount,
+               uint32_t *shards)
+{
+    Partition part;
+    uint32_t i;
+
+    if (shardCount < 1) {
+        fail(w, JDEP_ERROR_ARGUMENT, "there must be at least one shard");
+    }
+    buildSourceGraph(w, graph, &part);
+    weighSources(w, &part);
+    part.component = SCRATCH_ALLOC_MULTI(w, int, part.sourceCount + 1);
+    part.componentCount = findComponents(w, part.sourceCount, part.sourceRow,
+                                         part.sourceEdges, part.component);
+    buildComponentGraph(w, &part);
+    assignShards(w, &part, shardCount);
+    for (i = 0; i < graph->nodeCount; ++i) {
+        shards[i] = part.shard[part.component[part.sourceOf[i]]];
+    }
+}
+
+/* Write the list of source files in each shard to prefixN.list, in a form
+   javac will take as an @argfile */
+  static void
+writeShardLists(Worker *w, const Graph *graph, const uint32_t *shards,
+                int shardCount, const char *prefix)
+{
+    char *javaRoot = w->ctx->javaRoot;
+    int shard;
+
+    for (shard = 0; shard < shardCount; ++shard) {
+        char outfilename[1000];
+        char *source = NULL;
+        int sourceLength = 0;
+        FILE *outfyle;
+        uint32_t i;
+
+        formatPath(w, outfilename, sizeof(outfilename), "%s%d.list", prefix,
+                   shard);
+        outfyle = fopenPath(w, outfilename);
+        if (!outfyle) {
+            fail(w, JDEP_ERROR_IO, "unable to open shard list %s",
+                 outfilename);
+        }
+        for (i = 0; i < graph->nodeCount; ++i) {
+            char *name = &graph->names[graph->nameStart[i]];
+            char path[1000];
+            int length = outerLength(name);
+            if ((int) shards[i] != shard ||
+                    (source && length == sourceLength &&
+                     strncmp(source, name, length) == 0)) {
+                continue;
+            }
+            source = name;
+            sourceLength = length;
+            if (snprintf(path, sizeof(path), "%s%.*s.java", javaRoot, length,
+                         name) >= (int) sizeof(path)) {
+                fclose(outfyle);
+                fail(w, JDEP_ERROR_ARGUMENT, "path too long: %.200s%.*s.java",
+                     javaRoot, length, name);
+            }
+            if (access(path, F_OK) != -1) {
+                fprintf(outfyle, "%s\n", path);
+            }
+        }
+        fclose(outfyle);
+    }
+}
+
+  static void *
+defaultAlloc(void *user, size_t size)
+{
+    return malloc(size);
+}
+
+  static void *
+defaultRealloc(void *user, void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+  static void
+defaultFree(void *user, void *ptr)
+{
+    free(ptr);
+}
+
+/*
+  The API proper
+*/
+
+  jdep_status
+jdep_create(const jdep_allocator *allocator, jdep_context **result)
+{
+    jdep_context *ctx;
+    Worker *w;
+
+    if (!allocator) {
+        static const jdep_allocator standard = {
+            defaultAlloc, defaultRealloc, defaultFree, NULL
+        };
+        allocator = &standard;
+    }
+    *result = NULL;
+    ctx = (jdep_context *) allocator->alloc(allocator->user,
+                                            sizeof(jdep_context));
+    if (!ctx) {
+        return JDEP_ERROR_MEMORY;
+    }
+    memset(ctx, 0, sizeof(jdep_context));
+    ctx->allocator = *allocator;
+    ctx->workerMax = 1;
+    ctx->jobserverRead = -1;
+    ctx->jobserverWrite = -1;
+    pthread_mutex_init(&ctx->lock, NULL);
+    w = &ctx->main;
+    w->ctx = ctx;
+    if (setjmp(w->onError)) {
+        jdep_status status = w->status;
+        jdep_destroy(ctx);
+        return status;
+    }
+    ctx->classRoot = saveString(w, "");
+    ctx->depRoot = saveString(w, "");
+    ctx->javaRoot = saveString(w, "");
+    *result = ctx;
+    return JDEP_OK;
+}
+
+/* Let go of the jobserver.  A pipe's write end belongs to make, but the
+   read end was opened (or duplicated) separately (see openJobserver), as
+   was a fifo. */
+  static void
+closeJobserver(jdep_context *ctx)
+{
+    if (ctx->jobserverRead >= 0) {
+        close(ctx->jobserverRead);
+    }
+    ctx->jobserverRead = -1;
+    ctx->jobserverWrite = -1;
+}
+
+/* Find the jobserver that GNU make advertises in makeflags, if any.  Its
+   tokens are read without blocking, since by the time one turns up there
+   may be nothing left to do with it, but the pipe is shared with make and
+   all of its other jobs, so rather than changing its mode it's opened again
+   (by way of /proc) for our own use.  Where there's no /proc, a copy of
+   make's descriptor is used instead; acquireToken only reads from it once
+   poll says a token is there, so it can only block if another job takes
+   that token first, and then only until some job gives one back.  As with a
+   sub-make, if there is a jobserver and we can't use it, we work alone. */
+  static void
+openJobserver(Worker *w, const char *makeflags)
+{
+    jdep_context *ctx = w->ctx;
+    const char *auth = NULL;
+    const char *p;
+    char path[1000];
+    int readFd, writeFd;
+
+    for (p = makeflags; (p = strstr(p, "--jobserver-")); ++p) {
+        /* The last one wins; older versions of make call it -fds */
+        if (strncmp(p, "--jobserver-auth=", 17) == 0) {
+            auth = p + 17;
+        } else if (strncmp(p, "--jobserver-fds=", 16) == 0) {
+            auth = p + 16;
+        }
+    }
+    if (!auth) {
+        return;
+    }
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        formatPath(w, path, sizeof(path), "%.*s",
+                   (int) strcspn(auth + 5, " "), auth + 5);
+        ctx->jobserverRead = open(path, O_RDWR | O_NONBLOCK);
+        ctx->jobserverWrite = ctx->jobserverRead;
+    } else if (sscanf(auth, "%d,%d", &readFd, &writeFd) == 2 &&
+               fcntl(readFd, F_GETFD) >= 0 && fcntl(writeFd, F_GETFD) >= 0) {
+        formatPath(w, path, sizeof(path), "/proc/self/fd/%d", readFd);
+        ctx->jobserverRead = open(path, O_RDONLY | O_NONBLOCK);
+        if (ctx->jobserverRead < 0) {
+            ctx->jobserverRead = dup(readFd);
+        }
+        ctx->jobserverWrite = writeFd;
+    }
+    if (ctx->jobserverRead < 0) {
+        ctx->jobserverWrite = -1;
+        ctx->workerMax = 1;
+    }
+}
+
+  static void
+freePackages(Worker *w, PackageInfo *package)
+{
+    while (package) {
+        PackageInfo *next = package->next;
+        FREE(w, package);
+        package = next;
+    }
+}
+
+  void
+jdep_destroy(jdep_context *ctx)
+{
+    Worker *w;
+    int i;
+
+    if (!ctx) {
+        return;
+    }
+    w = &ctx->main;
+    FREE(w, ctx->classRoot);
+    FREE(w, ctx->depRoot);
+    FREE(w, ctx->javaRoot);
+    freePackages(w, ctx->excludedPackages);
+    freePackages(w, ctx->includedPackages);
+    if (ctx->knownDirectories) {
+        freeHashTable(w, ctx->knownDirectories);
+    }
+    if (ctx->graph) {
+        freeHashTable(w, ctx->graph->ids);
+        FREE(w, ctx->graph->names);
+        FREE(w, ctx->graph->edges);
+        FREE(w, ctx->graph);
+    }
+    freeBatch(w);
+    FREE(w, ctx->batchClasses.items);
+    FREE(w, ctx->dyndepFile);
+    if (ctx->dyndeps) {
+        freeHashTable(w, ctx->dyndeps->targets);
+        for (i = 0; i < ctx->dyndeps->count; ++i) {
+            FREE(w, ctx->dyndeps->lines[i]);
+        }
+        FREE(w, ctx->dyndeps->lines);
+        FREE(w, ctx->dyndeps);
+    }
+    while (ctx->jars) {
+        JarInfo *jar = ctx->jars;
+        ctx->jars = jar->next;
+        for (i = 0; i < jar->classCount; ++i) {
+            FREE(w, jar->classes[i]);
+        }
+        FREE(w, jar->classes);
+        FREE(w, jar);
+    }
+    FREE(w, ctx->classPath);
+    if (ctx->jarClasses) {
+        freeHashTable(w, ctx->jarClasses);
+    }
+    FREE(w, ctx->jarIndexFile);
+    FREE(w, ctx->constantIndexFile);
+    for (i = 0; i < ctx->constantOwnerCount; ++i) {
+        ConstantOwner *owner = ctx->constantOwners[i];
+        int j;
+        for (j = 0; j < owner->keyCount; ++j) {
+            FREE(w, owner->keys[j]);
+        }
+        FREE(w, owner->keys);
+        FREE(w, owner);
+    }
+    FREE(w, ctx->constantOwners);
+    if (ctx->constantOwnerIds) {
+        freeHashTable(w, ctx->constantOwnerIds);
+    }
+    if (ctx->constantClassesSeen) {
+        freeHashTable(w, ctx->constantClassesSeen);
+    }
+    if (ctx->constantValues) {
+        freeHashTable(w, ctx->constantValues);
+    }
+    FREE(w, ctx->constantDefs);
+    if (ctx->constantUses) {
+        freeHashTable(w, ctx->constantUses);
+    }
+    for (i = 0; i < ctx->constantUseCount; ++i) {
+        List *owners = &ctx->constantUseLists[i];
+        int j;
+        for (j = 0; j < owners->count; ++j) {
+            FREE(w, owners->items[j]);
+        }
+        FREE(w, owners->items);
+    }
+    FREE(w, ctx->constantUseLists);
+    clearQueue(w);
+    FREE(w, w->queue);
+    freeWorker(w);
+    closeJobserver(ctx);
+    pthread_mutex_destroy(&ctx->lock);
+    FREE(w, ctx);
+}
+
+  const char *
+jdep_error_message(const jdep_context *ctx)
+{
+    return ctx->main.message;
+}
+
+  jdep_status
+jdep_set_flags(jdep_context *ctx, unsigned int flags)
+{
+    ctx->flags = flags;
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_class_root(jdep_context *ctx, const char *path)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->classRoot);
+    ctx->classRoot = NULL;
+    ctx->classRoot = savePath(w, path);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_dep_root(jdep_context *ctx, const char *path)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->depRoot);
+    ctx->depRoot = NULL;
+    ctx->depRoot = savePath(w, path);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_java_root(jdep_context *ctx, const char *path)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->javaRoot);
+    ctx->javaRoot = NULL;
+    ctx->javaRoot = savePath(w, path);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_exclude_package(jdep_context *ctx, const char *package)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    excludePackage(w, package);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_include_package(jdep_context *ctx, const char *package)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    includePackage(w, package);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_add_jars(jdep_context *ctx, const char *jars)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    addJars(w, jars);
+    if (ctx->jarClasses) {
+        /* Index the class path again, new jars and all */
+        freeHashTable(w, ctx->jarClasses);
+        ctx->jarClasses = NULL;
+    }
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_jar_index(jdep_context *ctx, const char *filename)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->jarIndexFile);
+    ctx->jarIndexFile = NULL;
+    ctx->jarIndexFile = saveString(w, filename);
+    loadJarIndex(w, ctx->jarIndexFile);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_constant_index(jdep_context *ctx, const char *filename)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->constantIndexFile);
+    ctx->constantIndexFile = NULL;
+    ctx->constantIndexFile = saveString(w, filename);
+    loadConstantIndex(w, ctx->constantIndexFile);
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_add_constant_uses(jdep_context *ctx, const char *filename)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    loadConstantUses(w, scratchString(w, filename, strlen(filename)));
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_dyndep_file(jdep_context *ctx, const char *filename)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    FREE(w, ctx->dyndepFile);
+    ctx->dyndepFile = NULL;
+    ctx->dyndepFile = saveString(w, filename);
+    if (!ctx->dyndeps) {
+        ctx->dyndeps = buildDyndepInfo(w);
+    }
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_set_workers(jdep_context *ctx, int count, const char *makeflags)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    if (count < 1) {
+        fail(w, JDEP_ERROR_ARGUMENT, "there must be at least one worker");
+    }
+    closeJobserver(ctx);
+    ctx->workerMax = count;
+    if (makeflags && count > 1) {
+        openJobserver(w, makeflags);
+    }
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_analyze(jdep_context *ctx, const char *const files[], int count)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    prepareAnalysis(w);
+    analyzeFiles(w, files, count);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_class_prereqs(jdep_context *ctx, const char *file, const void *data,
+                   size_t length, jdep_prereq_callback callback, void *user)
+{
+    Worker *w = &ctx->main;
+    char *name;
+    int i;
+
+    CATCH_ERRORS(w);
+    prepareAnalysis(w);
+    name = classNameOf(w, scratchString(w, file, strlen(file)));
+    collectPrereqs(w, name, data, length, FALSE);
+    for (i = 0; i < w->prereqs.count; ++i) {
+        callback(user, w->prereqs.items[i]);
+    }
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_finish(jdep_context *ctx)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    if (ctx->dyndepFile) {
+        writeDyndepFile(w, ctx->dyndeps, ctx->dyndepFile);
+    }
+    if (ctx->jarIndexFile && ctx->jarIndexChanged) {
+        writeJarIndex(w, ctx->jarIndexFile);
+        ctx->jarIndexChanged = FALSE;
+    }
+    if (ctx->constantIndexFile) {
+        writeConstantIndex(w, ctx->constantIndexFile);
+    }
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_touch(jdep_context *ctx, const char *path)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    touchFile(w, scratchString(w, path, strlen(path)));
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_graph_build(jdep_context *ctx, jdep_graph **result)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    *result = NULL;
+    if (!(ctx->flags & JDEP_GRAPH)) {
+        fail(w, JDEP_ERROR_ARGUMENT, "no dependency graph was collected");
+    } else if (!ctx->graph) {
+        /* No class files were examined, so the graph is empty */
+        ctx->graph = buildGraphBuilder(w);
+    }
+    *result = buildGraph(w, ctx->graph);
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_graph_load(jdep_context *ctx, const char *filename, jdep_graph **result)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    *result = NULL;
+    *result = loadGraph(w, scratchString(w, filename, strlen(filename)));
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_graph_write(jdep_context *ctx, const jdep_graph *graph,
+                 const char *filename)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    writeGraph(w, graph, scratchString(w, filename, strlen(filename)));
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_graph_partition(jdep_context *ctx, const jdep_graph *graph,
+                     int shardCount, uint32_t shards[])
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    partitionGraph(w, graph, shardCount, shards);
+    scratchReset(w);
+    return JDEP_OK;
+}
+
+  jdep_status
+jdep_graph_write_shards(jdep_context *ctx, const jdep_graph *graph,
+                        const uint32_t shards[], int shardCount,
+                        const char *prefix)
+{
+    Worker *w = &ctx->main;
+    CATCH_ERRORS(w);
+    writeShardLists(w, graph, shards, shardCount, prefix);
+    return JDEP_OK;
+}
+
+  void
+jdep_graph_free(jdep_context *ctx, jdep_graph *graph)
+{
+    Worker *w = &ctx->main;
+
+    if (!graph) {
+        return;
+    }
+    if (graph->mapping) {
+        munmap(graph->mapping, graph->mappingSize);
+    }
+    FREE(w, graph);
+}
+
+  long
+jdep_graph_find(const jdep_graph *graph, const char *name)
+{
+    long low = 0;
+    long high = (long) graph->nodeCount - 1;
+
+    while (low <= high) {
+        long middle = low + (high - low) / 2;
+        int order = strcmp(&graph->names[graph->nameStart[middle]], name);
+        if (order == 0) {
+            return middle;
+        } else if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
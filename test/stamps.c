@@ -0,0 +1,319 @@
+/*
+  stamps.c -- check that -r shares stamp files the way it should
+
+  Copyright 2009 Chip Morningstar
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Writes a small tree of class files and sources into a scratch directory,
+  runs libjdep over all of them at once with JDEP_REDUCE and checks the .d
+  files that come out:
+
+  - the sources of the "hub" classes h/Log, h/Util and h/Config, which every
+    class in package a uses, become one stamp in each of the a classes' .d
+    files, next to the class's own source
+  - a hub's own .d file names its own source directly
+  - the sources of k/R0, k/R1 and k/R2, which all use one another, share a
+    stamp too, which is all the k classes' .d files have
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../jdep.h"
+
+#define USER_COUNT      10
+
+static char Dir[] = "/tmp/jdeptestXXXXXX";
+static int Failures = 0;
+
+static char *Hubs[] = { "h/Log", "h/Util", "h/Config", NULL };
+static char *Ring[] = { "k/R0", "k/R1", "k/R2", NULL };
+
+  static void
+check(int ok, const char *what, const char *where)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s: %s\n", where, what);
+        ++Failures;
+    }
+}
+
+  static void
+makeParents(char *path)
+{
+    char *slash;
+
+    for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0777);
+        *slash = '/';
+    }
+}
+
+  static void
+putWord(FILE *fyle, int value)
+{
+    putc((value >> 8) & 0xff, fyle);
+    putc(value & 0xff, fyle);
+}
+
+/* Write a class file whose constant pool names the class itself, its
+   superclass and each of the classes in uses (other than itself), and an
+   empty source file to go with it */
+  static void
+writeClass(char *name, char **uses)
+{
+    char *names[20];
+    char path[1000];
+    FILE *fyle;
+    int count = 0;
+    int i;
+
+    names[count++] = name;
+    names[count++] = "java/lang/Object";
+    for (i = 0; uses && uses[i]; ++i) {
+        if (strcmp(uses[i], name) != 0) {
+            names[count++] = uses[i];
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/classes/%s.class", Dir, name);
+    makeParents(path);
+    fyle = fopen(path, "wb");
+    if (!fyle) {
+        perror(path);
+        exit(1);
+    }
+    fputs("\xca\xfe\xba\xbe", fyle);
+    putWord(fyle, 0);                   /* minor_version */
+    putWord(fyle, 52);                  /* major_version */
+    putWord(fyle, count * 2 + 1);       /* constant_pool_count */
+    for (i = 0; i < count; ++i) {
+        putc(1, fyle);                  /* CONSTANT_Utf8 */
+        putWord(fyle, strlen(names[i]));
+        fputs(names[i], fyle);
+        putc(7, fyle);                  /* CONSTANT_Class */
+        putWord(fyle, i * 2 + 1);
+    }
+    putWord(fyle, 0x21);                /* access_flags */
+    putWord(fyle, 2);                   /* this_class */
+    putWord(fyle, 4);                   /* super_class */
+    putWord(fyle, 0);                   /* interfaces_count */
+    putWord(fyle, 0);                   /* fields_count */
+    putWord(fyle, 0);                   /* methods_count */
+    putWord(fyle, 0);                   /* attributes_count */
+    fclose(fyle);
+
+    snprintf(path, sizeof(path), "%s/java/%s.java", Dir, name);
+    makeParents(path);
+    fyle = fopen(path, "w");
+    if (!fyle) {
+        perror(path);
+        exit(1);
+    }
+    fclose(fyle);
+}
+
+/* Read the prerequisites from the .d file of class name into prereqs,
+   returning how many there are */
+  static int
+readDepFile(char *name, char prereqs[][1000], int max)
+{
+    char path[1000];
+    char line[1000];
+    FILE *fyle;
+    int count = 0;
+
+    snprintf(path, sizeof(path), "%s/deps/%s.d", Dir, name);
+    fyle = fopen(path, "r");
+    if (!fyle) {
+        check(0, "no .d file", name);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fyle)) {
+        if (strncmp(line, "  ", 2) == 0 && count < max) {
+            line[strcspn(line, "\\\n")] = '\0';
+            strcpy(prereqs[count++], line + 2);
+        }
+    }
+    fclose(fyle);
+    return count;
+}
+
+  static int
+isSource(char *prereq, char *name)
+{
+    char path[1000];
+
+    snprintf(path, sizeof(path), "%s/java/%s.java", Dir, name);
+    return strcmp(prereq, path) == 0;
+}
+
+  static int
+isStamp(char *prereq)
+{
+    return strstr(prereq, "/_stamps/") != NULL;
+}
+
+/* Check that the rule for stamp names the sources of exactly the classes in
+   names */
+  static void
+checkStamp(char *stamp, char **names, const char *where)
+{
+    char prereqs[20][1000];
+    char name[1000];
+    int count, i, j;
+
+    /* Its rule is in the .d file next to it */
+    snprintf(name, sizeof(name), "%.*s", (int) (strlen(stamp) -
+             strlen(Dir) - strlen("/deps/") - strlen(".stamp")),
+             stamp + strlen(Dir) + strlen("/deps/"));
+    count = readDepFile(name, prereqs, 20);
+    for (i = 0; names[i]; ++i) {
+        int found = 0;
+        for (j = 0; j < count; ++j) {
+            found |= isSource(prereqs[j], names[i]);
+        }
+        check(found, "stamp is missing a source", where);
+    }
+    check(count == i, "stamp has extra prerequisites", where);
+}
+
+  int
+main(int argc, char *argv[])
+{
+    const char *files[USER_COUNT + 6];
+    char paths[USER_COUNT + 6][1000];
+    char users[USER_COUNT][20];
+    char prereqs[20][1000];
+    char hubStamp[1000];
+    char ringStamp[1000];
+    char *uses[8];
+    char path[1000];
+    jdep_context *ctx;
+    int fileCount = 0;
+    int count, i, j;
+
+    if (!mkdtemp(Dir)) {
+        perror(Dir);
+        return 1;
+    }
+
+    for (i = 0; Hubs[i]; ++i) {
+        writeClass(Hubs[i], NULL);
+        files[fileCount++] = Hubs[i];
+    }
+    for (i = 0; Ring[i]; ++i) {
+        writeClass(Ring[i], Ring);
+        files[fileCount++] = Ring[i];
+    }
+    for (i = 0; i < USER_COUNT; ++i) {
+        snprintf(users[i], sizeof(users[i]), "a/C%02d", i);
+        for (j = 0; Hubs[j]; ++j) {
+            uses[j] = Hubs[j];
+        }
+        uses[j] = NULL;
+        writeClass(users[i], uses);
+        files[fileCount++] = users[i];
+    }
+    for (i = 0; i < fileCount; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/classes/%s.class", Dir,
+                 files[i]);
+        files[i] = paths[i];
+    }
+
+    if (jdep_create(NULL, &ctx) != JDEP_OK) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/classes", Dir);
+    jdep_set_class_root(ctx, path);
+    snprintf(path, sizeof(path), "%s/java", Dir);
+    jdep_set_java_root(ctx, path);
+    snprintf(path, sizeof(path), "%s/deps", Dir);
+    jdep_set_dep_root(ctx, path);
+    jdep_set_flags(ctx, JDEP_REDUCE);
+    if (jdep_analyze(ctx, files, fileCount) != JDEP_OK ||
+            jdep_finish(ctx) != JDEP_OK) {
+        fprintf(stderr, "%s\n", jdep_error_message(ctx));
+        return 1;
+    }
+    jdep_destroy(ctx);
+
+    /* Each user of the hubs has its own source and the hubs' stamp */
+    hubStamp[0] = '\0';
+    for (i = 0; i < USER_COUNT; ++i) {
+        count = readDepFile(users[i], prereqs, 20);
+        check(count == 2, "expected two prerequisites", users[i]);
+        if (count == 2) {
+            check(isSource(prereqs[0], users[i]), "own source missing",
+                  users[i]);
+            check(isStamp(prereqs[1]), "stamp missing", users[i]);
+            if (!hubStamp[0]) {
+                strcpy(hubStamp, prereqs[1]);
+            }
+            check(strcmp(prereqs[1], hubStamp) == 0, "a different stamp",
+                  users[i]);
+        }
+    }
+    if (hubStamp[0]) {
+        checkStamp(hubStamp, Hubs, "hub stamp");
+    }
+
+    /* A hub just has its own source */
+    for (i = 0; Hubs[i]; ++i) {
+        count = readDepFile(Hubs[i], prereqs, 20);
+        check(count == 1 && isSource(prereqs[0], Hubs[i]),
+              "expected just its own source", Hubs[i]);
+    }
+
+    /* The classes that use one another all have the ring's stamp, and
+       nothing else */
+    ringStamp[0] = '\0';
+    for (i = 0; Ring[i]; ++i) {
+        count = readDepFile(Ring[i], prereqs, 20);
+        check(count == 1 && isStamp(prereqs[0]), "expected just a stamp",
+              Ring[i]);
+        if (count == 1) {
+            if (!ringStamp[0]) {
+                strcpy(ringStamp, prereqs[0]);
+            }
+            check(strcmp(prereqs[0], ringStamp) == 0, "a different stamp",
+                  Ring[i]);
+        }
+    }
+    if (ringStamp[0]) {
+        checkStamp(ringStamp, Ring, "ring stamp");
+    }
+
+    snprintf(path, sizeof(path), "rm -rf %s", Dir);
+    if (system(path) != 0) {
+        fprintf(stderr, "unable to remove %s\n", Dir);
+    }
+    if (Failures > 0) {
+        return 1;
+    }
+    printf("stamps: ok\n");
+    return 0;
+}